@@ -1,4 +1,5 @@
 TEMPLATE = subdirs
 CONFIG += ordered
-SUBDIRS += src/SeimiAgent.pro
+SUBDIRS += src/SeimiAgent.pro \
+    bench/bench.pro
 OTHER_FILES += build.py README.md zh.md
@@ -0,0 +1,5 @@
+TEMPLATE = subdirs
+SUBDIRS += loadgen/loadgen.pro \
+    fixtures/fixtures.pro \
+    micro/micro.pro \
+    render/render.pro
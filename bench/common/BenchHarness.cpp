@@ -0,0 +1,226 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <atomic>
+#include <stdlib.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include "BenchHarness.h"
+
+namespace {
+std::atomic<long long> allocationCounter(0);
+}
+
+#if defined(__GLIBC__)
+// Every allocation of the process goes through here, Qt containers included.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void *ptr, size_t size);
+
+void* malloc(size_t size){
+    allocationCounter.fetch_add(1,std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size){
+    allocationCounter.fetch_add(1,std::memory_order_relaxed);
+    return __libc_calloc(count,size);
+}
+
+void* realloc(void *ptr, size_t size){
+    allocationCounter.fetch_add(1,std::memory_order_relaxed);
+    return __libc_realloc(ptr,size);
+}
+}
+#endif
+
+BenchTimer::BenchTimer() : _running(false), _elapsedNs(0), _allocations(0), _allocationsAtStart(0)
+{
+
+}
+
+void BenchTimer::start(){
+    if(_running){
+        return;
+    }
+    _running = true;
+    _allocationsAtStart = BenchHarness::allocationCount();
+    _clock.start();
+}
+
+void BenchTimer::stop(){
+    if(!_running){
+        return;
+    }
+    _elapsedNs += _clock.nsecsElapsed();
+    _allocations += BenchHarness::allocationCount() - _allocationsAtStart;
+    _running = false;
+}
+
+void BenchTimer::reset(){
+    _running = false;
+    _elapsedNs = 0;
+    _allocations = 0;
+}
+
+BenchHarness::BenchHarness() : _minTimeMs(500)
+{
+
+}
+
+void BenchHarness::add(const QString &name, const Benchmark &benchmark){
+    _benchmarks.append(qMakePair(name,benchmark));
+}
+
+void BenchHarness::setMinTime(int minTimeMs){
+    _minTimeMs = qMax(1,minTimeMs);
+}
+
+void BenchHarness::setFilter(const QStringList &filter){
+    _filter = filter;
+}
+
+void BenchHarness::keep(const void *p){
+    static const void* volatile sink;
+    sink = p;
+}
+
+bool BenchHarness::countsAllocations(){
+#if defined(__GLIBC__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+qint64 BenchHarness::allocationCount(){
+    return allocationCounter.load(std::memory_order_relaxed);
+}
+
+QVector<BenchResult> BenchHarness::run(){
+    QVector<BenchResult> results;
+    QTextStream err(stderr);
+    for (int i = 0; i < _benchmarks.size(); ++i) {
+        const QString &name = _benchmarks.at(i).first;
+        if(!_filter.isEmpty()){
+            bool selected = false;
+            foreach (const QString &filter, _filter) {
+                selected = selected || name.contains(filter);
+            }
+            if(!selected){
+                continue;
+            }
+        }
+        err << "running " << name << endl;
+        const Benchmark &benchmark = _benchmarks.at(i).second;
+        BenchTimer timer;
+        // one untimed pass warms caches and lazily built state
+        benchmark(1,timer);
+        qint64 iterations = 1;
+        while (true) {
+            timer.reset();
+            timer.start();
+            benchmark(int(iterations),timer);
+            timer.stop();
+            qint64 elapsedMs = timer.elapsedNs() / 1000000;
+            if(elapsedMs >= _minTimeMs || iterations >= 1000000000){
+                break;
+            }
+            // aim 20% past minTime, growing at most 100x per step
+            qint64 next = elapsedMs <= 0 ? iterations * 100 : iterations * _minTimeMs * 12 / 10 / elapsedMs;
+            iterations = qBound(iterations + 1,next,qMin(iterations * 100,qint64(1000000000)));
+        }
+        BenchResult result;
+        result.name = name;
+        result.iterations = iterations;
+        result.nsPerOp = double(timer.elapsedNs()) / iterations;
+        result.allocsPerOp = countsAllocations() ? double(timer.allocations()) / iterations : -1;
+        results.append(result);
+    }
+    return results;
+}
+
+QString BenchHarness::textReport(const QVector<BenchResult> &results){
+    QString text;
+    QTextStream out(&text);
+    int nameWidth = 10;
+    foreach (const BenchResult &result, results) {
+        nameWidth = qMax(nameWidth,result.name.size());
+    }
+    foreach (const BenchResult &result, results) {
+        out << result.name.leftJustified(nameWidth + 2)
+            << QString::number(result.iterations).rightJustified(12)
+            << QString::number(result.nsPerOp,'f',1).rightJustified(16) << " ns/op"
+            << (result.allocsPerOp < 0 ? QString("           - allocs/op") : QString::number(result.allocsPerOp,'f',2).rightJustified(12) + " allocs/op")
+            << "\n";
+    }
+    out.flush();
+    return text;
+}
+
+QJsonArray BenchHarness::jsonReport(const QVector<BenchResult> &results){
+    QJsonArray out;
+    foreach (const BenchResult &result, results) {
+        QJsonObject item;
+        item.insert("name",result.name);
+        item.insert("iterations",result.iterations);
+        item.insert("nsPerOp",result.nsPerOp);
+        if(result.allocsPerOp >= 0){
+            item.insert("allocsPerOp",result.allocsPerOp);
+        }
+        out.append(item);
+    }
+    return out;
+}
+
+int benchMain(BenchHarness &harness, const QString &description){
+    QCommandLineParser parser;
+    parser.setApplicationDescription(description);
+    parser.addHelpOption();
+    QCommandLineOption minTimeOption("min-time","Run every benchmark at least this many ms,default 500.","ms","500");
+    QCommandLineOption jsonOption("json","Also write the results as JSON to this file,`-` means stdout.","file");
+    parser.addOption(minTimeOption);
+    parser.addOption(jsonOption);
+    parser.addPositionalArgument("filter","Only run the benchmarks whose name contains one of these.","[filter...]");
+    parser.process(QCoreApplication::arguments());
+
+    harness.setMinTime(parser.value(minTimeOption).toInt());
+    harness.setFilter(parser.positionalArguments());
+    QTextStream out(stdout);
+    QVector<BenchResult> results = harness.run();
+    out << BenchHarness::textReport(results);
+    out.flush();
+    if(parser.isSet(jsonOption)){
+        QJsonObject report;
+        report.insert("benchmarks",BenchHarness::jsonReport(results));
+        QByteArray json = QJsonDocument(report).toJson();
+        if(parser.value(jsonOption) == "-"){
+            out << json;
+        }else{
+            QFile file(parser.value(jsonOption));
+            if(!file.open(QIODevice::WriteOnly|QIODevice::Truncate)){
+                QTextStream(stderr) << "can not write " << parser.value(jsonOption) << endl;
+                return 1;
+            }
+            file.write(json);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef BENCHHARNESS_H
+#define BENCHHARNESS_H
+
+#include <functional>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QJsonArray>
+
+/**
+ * Timing of one benchmark run. A benchmark may pause it around its own setup so only
+ * the code under test is counted, both for time and for allocations.
+ */
+class BenchTimer
+{
+public:
+    BenchTimer();
+    void start();
+    void stop();
+    void reset();
+    qint64 elapsedNs() const { return _elapsedNs; }
+    qint64 allocations() const { return _allocations; }
+
+private:
+    QElapsedTimer _clock;
+    bool _running;
+    qint64 _elapsedNs;
+    qint64 _allocations;
+    qint64 _allocationsAtStart;
+};
+
+struct BenchResult
+{
+    QString name;
+    qint64 iterations;
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+/**
+ * Runs every registered benchmark with a growing number of iterations until one run lasts
+ * at least minTimeMs, then reports ns/op and allocs/op of that run.
+ * Allocations are counted by hooking malloc, so only glibc builds report them.
+ */
+class BenchHarness
+{
+public:
+    typedef std::function<void(int iterations, BenchTimer &timer)> Benchmark;
+
+    BenchHarness();
+    void add(const QString &name, const Benchmark &benchmark);
+    void setMinTime(int minTimeMs);
+    void setFilter(const QStringList &filter);
+    QVector<BenchResult> run();
+    static QString textReport(const QVector<BenchResult> &results);
+    static QJsonArray jsonReport(const QVector<BenchResult> &results);
+    /**
+     * keeps the compiler from dropping a result that is never used
+     */
+    static void keep(const void *p);
+    static bool countsAllocations();
+    static qint64 allocationCount();
+
+private:
+    QVector<QPair<QString, Benchmark> > _benchmarks;
+    int _minTimeMs;
+    QStringList _filter;
+};
+
+/**
+ * Parses --min-time, --json and the benchmark name filters shared by every bench executable,
+ * runs the benchmarks and prints the report. Returns the process exit code.
+ */
+int benchMain(BenchHarness &harness, const QString &description);
+
+#endif // BENCHHARNESS_H
@@ -0,0 +1,8 @@
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/BenchHarness.cpp
+
+HEADERS += \
+    $$PWD/BenchHarness.h
@@ -0,0 +1,223 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QUrlQuery>
+#include "FixtureHandler.h"
+
+namespace {
+// 1x1 transparent png
+const char PIXEL_PNG[] = "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x01\x00\x00\x00\x01\x08\x06\x00\x00\x00\x1f\x15\xc4\x89"
+                         "\x00\x00\x00\x0b\x49\x44\x41\x54\x78\xda\x63\x60\x00\x02\x00\x00\x05\x00\x01\xe9\xfa\xdc\xd8\x00\x00\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82";
+const int MaxLatencyMs = 60000;
+
+const char* const WORDS[] = {"seimi","agent","render","webkit","crawler","page","node","fixture","bench","layout","paint","script"};
+const int WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+/**
+ * the same seed always gives the same page
+ */
+class Lcg
+{
+public:
+    explicit Lcg(uint seed) : _state(seed * 2654435761u + 1) {}
+    uint next(uint bound){
+        _state = _state * 1103515245u + 12345u;
+        return (_state >> 16) % bound;
+    }
+private:
+    uint _state;
+};
+}
+
+FixtureHandler::FixtureHandler(QObject *parent) : Pillow::HttpHandler(parent)
+{
+
+}
+
+bool FixtureHandler::handleRequest(Pillow::HttpConnection *connection){
+    if(connection->requestMethod() != "GET"){
+        return false;
+    }
+    QString path = connection->requestPathDecoded();
+    if(path == "/page"){
+        servePage(connection);
+        return true;
+    }
+    if(path.startsWith("/res/")){
+        serveResource(connection,path.mid(5));
+        return true;
+    }
+    if(path.startsWith("/xhr/")){
+        serveXhr(connection,path.mid(5));
+        return true;
+    }
+    return false;
+}
+
+int FixtureHandler::intParam(Pillow::HttpConnection *connection, const QString &name, int defaultValue, int max){
+    QString value = connection->requestParamValue(name);
+    bool ok = false;
+    int n = value.toInt(&ok);
+    if(!ok){
+        return defaultValue;
+    }
+    return qBound(0,n,max);
+}
+
+void FixtureHandler::servePage(Pillow::HttpConnection *connection){
+    int redirects = intParam(connection,"redirects",0,100);
+    int docLatency = intParam(connection,"docLatency",0,MaxLatencyMs);
+    if(redirects > 0){
+        QUrlQuery query(QString::fromUtf8(connection->requestQueryString()));
+        query.removeAllQueryItems("redirects");
+        query.addQueryItem("redirects",QString::number(redirects - 1));
+        Pillow::HttpHeaderCollection headers;
+        headers << Pillow::HttpHeader("Location", QByteArray("/page?") + query.query(QUrl::FullyEncoded).toUtf8());
+        respond(connection,docLatency,302,headers,QByteArray());
+        return;
+    }
+    int dom = intParam(connection,"dom",100,1000000);
+    int resources = intParam(connection,"resources",0,10000);
+    int xhr = intParam(connection,"xhr",0,1000);
+    int timers = intParam(connection,"timers",0,1000);
+    int timerStep = intParam(connection,"timerStep",100,MaxLatencyMs);
+    int latency = intParam(connection,"latency",0,MaxLatencyMs);
+    int xhrLatency = intParam(connection,"xhrLatency",latency,MaxLatencyMs);
+    uint seed = connection->requestParamValue("seed").toUInt();
+    Lcg lcg(seed);
+
+    QByteArray html;
+    html.reserve(dom * 48 + resources * 64 + 1024);
+    html += "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>fixture ";
+    html += QByteArray::number(seed);
+    html += "</title>\n";
+    // subresources cycle through css, js and png
+    for (int i = 0; i < resources; i += 3) {
+        html += "<link rel=\"stylesheet\" href=\"/res/" + QByteArray::number(i) + ".css?latency=" + QByteArray::number(latency) + "\">\n";
+    }
+    html += "</head><body>\n";
+    for (int i = 0; i < dom; ++i) {
+        if(i % 10 == 0){
+            html += i == 0 ? "<div class=\"s\">" : "</div>\n<div class=\"s\">";
+        }
+        html += "<p id=\"n" + QByteArray::number(i) + "\">";
+        int words = 2 + lcg.next(6);
+        for (int w = 0; w < words; ++w) {
+            html += WORDS[lcg.next(WORD_COUNT)];
+            html += ' ';
+        }
+        html += "</p>";
+    }
+    if(dom > 0){
+        html += "</div>\n";
+    }
+    for (int i = 2; i < resources; i += 3) {
+        html += "<img src=\"/res/" + QByteArray::number(i) + ".png?latency=" + QByteArray::number(latency) + "\" width=\"16\" height=\"16\">\n";
+    }
+    for (int i = 1; i < resources; i += 3) {
+        html += "<script src=\"/res/" + QByteArray::number(i) + ".js?latency=" + QByteArray::number(latency) + "\"></script>\n";
+    }
+    if(xhr > 0 || timers > 0){
+        html += "<script>\nfunction fixtureAppend(text){var d=document.createElement('div');d.innerHTML=text;document.body.appendChild(d);}\n";
+        for (int i = 0; i < xhr; ++i) {
+            html += "(function(){var x=new XMLHttpRequest();x.open('GET','/xhr/" + QByteArray::number(i) + "?latency=" + QByteArray::number(xhrLatency)
+                    + "');x.onload=function(){fixtureAppend(x.responseText);};x.send();})();\n";
+        }
+        for (int i = 1; i <= timers; ++i) {
+            html += "setTimeout(function(){fixtureAppend('<p class=\"timer\">timer " + QByteArray::number(i) + "</p>');}," + QByteArray::number(i * timerStep) + ");\n";
+        }
+        html += "</script>\n";
+    }
+    html += "</body></html>\n";
+
+    Pillow::HttpHeaderCollection headers;
+    headers << Pillow::HttpHeader("Content-Type", "text/html; charset=utf-8");
+    respond(connection,docLatency,200,headers,html);
+}
+
+void FixtureHandler::serveResource(Pillow::HttpConnection *connection, const QString &name){
+    int latency = intParam(connection,"latency",0,MaxLatencyMs);
+    QString id = name.section('.',0,0);
+    Pillow::HttpHeaderCollection headers;
+    QByteArray content;
+    if(name.endsWith(".css")){
+        headers << Pillow::HttpHeader("Content-Type", "text/css");
+        content = ".r" + id.toUtf8() + "{color:#333;margin:" + QByteArray::number(id.toInt() % 8) + "px}\n.s p{line-height:1.4}\n";
+    }else if(name.endsWith(".js")){
+        headers << Pillow::HttpHeader("Content-Type", "application/javascript");
+        content = "window.fixture" + id.toUtf8() + "=function(){var n=0;for(var i=0;i<1000;i++){n+=i;}return n;};window.fixture" + id.toUtf8() + "();\n";
+    }else if(name.endsWith(".png")){
+        headers << Pillow::HttpHeader("Content-Type", "image/png");
+        content = QByteArray(PIXEL_PNG, sizeof(PIXEL_PNG) - 1);
+    }else{
+        respond(connection,0,404,Pillow::HttpHeaderCollection(),QByteArray());
+        return;
+    }
+    headers << Pillow::HttpHeader("Cache-Control", "no-cache");
+    respond(connection,latency,200,headers,content);
+}
+
+void FixtureHandler::serveXhr(Pillow::HttpConnection *connection, const QString &name){
+    int latency = intParam(connection,"latency",0,MaxLatencyMs);
+    Pillow::HttpHeaderCollection headers;
+    headers << Pillow::HttpHeader("Content-Type", "text/html; charset=utf-8");
+    headers << Pillow::HttpHeader("Cache-Control", "no-cache");
+    QByteArray content = "<ul class=\"xhr\" id=\"xhr" + name.toUtf8() + "\">";
+    for (int i = 0; i < 10; ++i) {
+        content += "<li>xhr " + name.toUtf8() + " item " + QByteArray::number(i) + "</li>";
+    }
+    content += "</ul>";
+    respond(connection,latency,200,headers,content);
+}
+
+void FixtureHandler::respond(Pillow::HttpConnection *connection, int delayMs, int statusCode, const Pillow::HttpHeaderCollection &headers, const QByteArray &content){
+    if(delayMs <= 0){
+        connection->writeResponse(statusCode,headers,content);
+        return;
+    }
+    FixtureResponse response;
+    response.timer = new QTimer(this);
+    response.timer->setSingleShot(true);
+    response.timer->setProperty("connection",QVariant::fromValue<QObject*>(connection));
+    response.statusCode = statusCode;
+    response.headers = headers;
+    response.content = content;
+    _pending.insert(connection,response);
+    connect(response.timer,SIGNAL(timeout()),this,SLOT(delayedRespond()));
+    connect(connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(clientGone(Pillow::HttpConnection*)));
+    response.timer->start(delayMs);
+}
+
+void FixtureHandler::delayedRespond(){
+    QTimer *timer = static_cast<QTimer*>(sender());
+    Pillow::HttpConnection *connection = static_cast<Pillow::HttpConnection*>(timer->property("connection").value<QObject*>());
+    timer->deleteLater();
+    if(!_pending.contains(connection)){
+        return;
+    }
+    FixtureResponse response = _pending.take(connection);
+    disconnect(connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(clientGone(Pillow::HttpConnection*)));
+    connection->writeResponse(response.statusCode,response.headers,response.content);
+}
+
+void FixtureHandler::clientGone(Pillow::HttpConnection *connection){
+    disconnect(connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(clientGone(Pillow::HttpConnection*)));
+    if(_pending.contains(connection)){
+        // connections are reused, the timer must not answer whatever request comes next on it
+        FixtureResponse response = _pending.take(connection);
+        response.timer->stop();
+        response.timer->deleteLater();
+    }
+}
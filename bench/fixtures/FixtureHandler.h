@@ -0,0 +1,61 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef FIXTUREHANDLER_H
+#define FIXTUREHANDLER_H
+
+#include <QHash>
+#include <QTimer>
+#include "HttpHandler.h"
+#include "HttpConnection.h"
+
+struct FixtureResponse
+{
+    QTimer *timer;
+    int statusCode;
+    Pillow::HttpHeaderCollection headers;
+    QByteArray content;
+};
+
+/**
+ * Serves generated pages whose cost is set by the query string, so renders can be compared
+ * between builds against the same deterministic corpus:
+ *   /page?dom=2000&resources=20&xhr=4&timers=5&timerStep=100&latency=50&xhrLatency=200&redirects=3&seed=1
+ *   /res/<n>.css|js|png?latency=ms   one subresource
+ *   /xhr/<n>?latency=ms              a fragment the page appends to its DOM
+ * Every other GET is passed on, e.g. to a HttpHandlerFile serving a static corpus.
+ */
+class FixtureHandler : public Pillow::HttpHandler
+{
+    Q_OBJECT
+public:
+    FixtureHandler(QObject *parent = 0);
+    bool handleRequest(Pillow::HttpConnection *connection);
+
+private slots:
+    void delayedRespond();
+    void clientGone(Pillow::HttpConnection *connection);
+
+private:
+    void servePage(Pillow::HttpConnection *connection);
+    void serveResource(Pillow::HttpConnection *connection, const QString &name);
+    void serveXhr(Pillow::HttpConnection *connection, const QString &name);
+    void respond(Pillow::HttpConnection *connection, int delayMs, int statusCode, const Pillow::HttpHeaderCollection &headers, const QByteArray &content);
+    static int intParam(Pillow::HttpConnection *connection, const QString &name, int defaultValue, int max);
+
+    QHash<Pillow::HttpConnection*, FixtureResponse> _pending;
+};
+
+#endif // FIXTUREHANDLER_H
@@ -0,0 +1,15 @@
+QT += core network
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = seimiagent-fixtures
+DESTDIR = ../../bin
+
+SOURCES += main.cpp \
+    FixtureHandler.cpp
+
+HEADERS += \
+    FixtureHandler.h
+
+include(../../src/pillowcore/pillowcore.pri)
@@ -0,0 +1,55 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QTextStream>
+#include "HttpServer.h"
+#include "HttpHandler.h"
+#include "FixtureHandler.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("seimiagent-fixtures");
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Serves generated pages of controllable cost so render benchmarks can run locally and be compared between builds.");
+    parser.addHelpOption();
+    QCommandLineOption portOption(QStringList() << "p" << "port","The port to listen on,default 8080.","port","8080");
+    QCommandLineOption listenOption("listen","The address to listen on,default 127.0.0.1.","address","127.0.0.1");
+    QCommandLineOption rootOption("root","Also serve the static files of this directory,e.g. saved real world pages.","dir");
+    parser.addOption(portOption);
+    parser.addOption(listenOption);
+    parser.addOption(rootOption);
+    parser.process(a);
+
+    QTextStream err(stderr);
+    quint16 port = parser.value(portOption).toUShort();
+    Pillow::HttpServer server(QHostAddress(parser.value(listenOption)), port);
+    if(!server.isListening()){
+        err << "can not listen on " << parser.value(listenOption) << ":" << port << endl;
+        return 1;
+    }
+    Pillow::HttpHandler* handler = new Pillow::HttpHandlerStack(&server);
+        new FixtureHandler(handler);
+        if(parser.isSet(rootOption)){
+            new Pillow::HttpHandlerFile(QDir(parser.value(rootOption)).absolutePath(), handler);
+        }
+        new Pillow::HttpHandler404(handler);
+    QObject::connect(&server, SIGNAL(requestReady(Pillow::HttpConnection*)), handler, SLOT(handleRequest(Pillow::HttpConnection*)));
+    err << "fixtures listening on " << parser.value(listenOption) << ":" << port << endl;
+    return a.exec();
+}
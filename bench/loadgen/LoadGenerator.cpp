@@ -0,0 +1,282 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QFile>
+#include <QJsonArray>
+#include <QTextStream>
+#include <QUrlQuery>
+#include <QRegExp>
+#include <algorithm>
+#include <stdlib.h>
+#include "LoadGenerator.h"
+
+LoadGenerator::LoadGenerator(QObject *parent) : QObject(parent),
+    _target("http://127.0.0.1:8000/doload"),
+    _concurrency(8),
+    _durationSeconds(30),
+    _requestTimeoutMs(0),
+    _totalWeight(0),
+    _sending(false),
+    _elapsedMs(0)
+{
+    _timeoutChecker.setInterval(100);
+    connect(&_timeoutChecker,SIGNAL(timeout()),this,SLOT(checkTimeouts()));
+}
+
+void LoadGenerator::setTarget(const QUrl &target){
+    _target = target;
+}
+
+void LoadGenerator::setConcurrency(int concurrency){
+    _concurrency = qMax(1,concurrency);
+}
+
+void LoadGenerator::setDuration(int seconds){
+    _durationSeconds = qMax(1,seconds);
+}
+
+void LoadGenerator::setRequestTimeout(int ms){
+    _requestTimeoutMs = qMax(0,ms);
+}
+
+void LoadGenerator::setSeed(uint seed){
+    srand(seed);
+}
+
+void LoadGenerator::addRequest(const LoadRequest &request){
+    if(request.weight <= 0){
+        return;
+    }
+    _requests.append(request);
+    _totalWeight += request.weight;
+}
+
+bool LoadGenerator::loadMix(const QString &path){
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly|QIODevice::Text)){
+        return false;
+    }
+    QTextStream in(&file);
+    while(!in.atEnd()){
+        QString line = in.readLine().trimmed();
+        if(line.isEmpty() || line.startsWith('#')){
+            continue;
+        }
+        int split = line.indexOf(QRegExp("\\s"));
+        if(split <= 0){
+            continue;
+        }
+        LoadRequest request;
+        request.weight = line.left(split).toInt();
+        request.body = line.mid(split).trimmed().toUtf8();
+        QUrlQuery query(QString::fromUtf8(request.body));
+        request.label = query.queryItemValue("contentType").isEmpty() ? QString("html") : query.queryItemValue("contentType");
+        addRequest(request);
+    }
+    return true;
+}
+
+bool LoadGenerator::hasRequests(){
+    return !_requests.isEmpty();
+}
+
+void LoadGenerator::start(){
+    _sending = true;
+    _clock.start();
+    QTimer::singleShot(_durationSeconds * 1000,this,SLOT(stopSending()));
+    if(_requestTimeoutMs > 0){
+        _timeoutChecker.start();
+    }
+    for (int i = 0; i < _concurrency; ++i) {
+        Pillow::HttpClient *client = new Pillow::HttpClient(this);
+        connect(client,SIGNAL(finished()),this,SLOT(clientFinished()));
+        _clients.append(client);
+        send(client);
+    }
+}
+
+const LoadRequest& LoadGenerator::pickRequest(){
+    int ticket = rand() % _totalWeight;
+    for (int i = 0; i < _requests.size(); ++i) {
+        ticket -= _requests.at(i).weight;
+        if(ticket < 0){
+            return _requests.at(i);
+        }
+    }
+    return _requests.last();
+}
+
+void LoadGenerator::send(Pillow::HttpClient *client){
+    int index = &pickRequest() - _requests.constData();
+    _inFlight[client] = index;
+    _sentAt[client] = _clock.nsecsElapsed() / 1000;
+    Pillow::HttpHeaderCollection headers;
+    headers << Pillow::HttpHeader("Content-Type", "application/x-www-form-urlencoded");
+    client->post(_target,headers,_requests.at(index).body);
+}
+
+void LoadGenerator::clientFinished(){
+    Pillow::HttpClient *client = static_cast<Pillow::HttpClient*>(sender());
+    if(!_inFlight.contains(client)){
+        return;
+    }
+    qint64 latencyUs = _clock.nsecsElapsed() / 1000 - _sentAt.value(client);
+    const LoadRequest &request = _requests.at(_inFlight.take(client));
+    QString error;
+    switch (client->error()) {
+    case Pillow::HttpClient::NoError: break;
+    case Pillow::HttpClient::NetworkError: error = "network"; break;
+    case Pillow::HttpClient::ResponseInvalidError: error = "invalid_response"; break;
+    case Pillow::HttpClient::RemoteHostClosedError: error = "closed"; break;
+    case Pillow::HttpClient::AbortedError: error = "timeout"; break;
+    }
+    int status = error.isEmpty() ? client->statusCode() : 0;
+    if(error.isEmpty() && status >= 400){
+        error = QString("http_%1").arg(status);
+    }
+    record(request.label,status,error,latencyUs,client->consumeContent().size());
+    if(_sending){
+        send(client);
+    }else if(_inFlight.isEmpty()){
+        _timeoutChecker.stop();
+        emit done();
+    }
+}
+
+void LoadGenerator::checkTimeouts(){
+    qint64 now = _clock.nsecsElapsed() / 1000;
+    foreach (Pillow::HttpClient *client, _inFlight.keys()) {
+        if(now - _sentAt.value(client) > qint64(_requestTimeoutMs) * 1000){
+            // finished is emitted with AbortedError
+            client->abort();
+        }
+    }
+}
+
+void LoadGenerator::stopSending(){
+    _sending = false;
+    _elapsedMs = _clock.elapsed();
+    // the report covers the requests answered within the duration and the ones draining after it
+    if(_inFlight.isEmpty()){
+        emit done();
+    }
+}
+
+void LoadGenerator::record(const QString &label, int status, const QString &error, qint64 latencyUs, qint64 bytes){
+    LoadStats *targets[] = {&_total, &_byLabel[label]};
+    for (int i = 0; i < 2; ++i) {
+        LoadStats *stats = targets[i];
+        stats->sent++;
+        stats->bytesIn += bytes;
+        if(status > 0){
+            stats->statuses[status]++;
+        }
+        if(!error.isEmpty()){
+            stats->errors[error]++;
+        }else{
+            stats->latenciesUs.append(latencyUs);
+        }
+    }
+}
+
+qint64 LoadGenerator::percentile(const QVector<qint64> &sorted, double p){
+    if(sorted.isEmpty()){
+        return 0;
+    }
+    int rank = qBound(0,int(sorted.size() * p / 100.0 + 0.5) - 1,sorted.size() - 1);
+    return sorted.at(rank);
+}
+
+QJsonObject LoadGenerator::statsJson(const LoadStats &stats, double seconds){
+    QVector<qint64> sorted = stats.latenciesUs;
+    std::sort(sorted.begin(),sorted.end());
+    qint64 errors = 0;
+    QJsonObject errorsJson;
+    for (QMap<QString, qint64>::const_iterator it = stats.errors.constBegin(); it != stats.errors.constEnd(); ++it) {
+        errors += it.value();
+        errorsJson.insert(it.key(),it.value());
+    }
+    QJsonObject statusesJson;
+    for (QMap<int, qint64>::const_iterator it = stats.statuses.constBegin(); it != stats.statuses.constEnd(); ++it) {
+        statusesJson.insert(QString::number(it.key()),it.value());
+    }
+    qint64 sum = 0;
+    foreach (qint64 latency, sorted) {
+        sum += latency;
+    }
+    QJsonObject latency;
+    latency.insert("mean",sorted.isEmpty() ? 0 : sum / 1000.0 / sorted.size());
+    latency.insert("p50",percentile(sorted,50) / 1000.0);
+    latency.insert("p90",percentile(sorted,90) / 1000.0);
+    latency.insert("p99",percentile(sorted,99) / 1000.0);
+    latency.insert("p999",percentile(sorted,99.9) / 1000.0);
+    latency.insert("max",sorted.isEmpty() ? 0 : sorted.last() / 1000.0);
+    QJsonObject out;
+    out.insert("requests",stats.sent);
+    out.insert("ok",sorted.size());
+    out.insert("errors",errors);
+    out.insert("errorRate",stats.sent == 0 ? 0 : double(errors) / stats.sent);
+    out.insert("throughput",seconds <= 0 ? 0 : sorted.size() / seconds);
+    out.insert("bytesIn",stats.bytesIn);
+    out.insert("latencyMs",latency);
+    out.insert("statuses",statusesJson);
+    out.insert("errorsByKind",errorsJson);
+    return out;
+}
+
+QJsonObject LoadGenerator::jsonReport(){
+    double seconds = (_elapsedMs > 0 ? _elapsedMs : _clock.elapsed()) / 1000.0;
+    QJsonObject byLabel;
+    for (QMap<QString, LoadStats>::const_iterator it = _byLabel.constBegin(); it != _byLabel.constEnd(); ++it) {
+        byLabel.insert(it.key(),statsJson(it.value(),seconds));
+    }
+    QJsonObject out;
+    out.insert("target",_target.toString());
+    out.insert("concurrency",_concurrency);
+    out.insert("durationSeconds",seconds);
+    out.insert("total",statsJson(_total,seconds));
+    out.insert("byContentType",byLabel);
+    return out;
+}
+
+QString LoadGenerator::textReport(){
+    QJsonObject report = jsonReport();
+    QString text;
+    QTextStream out(&text);
+    out << "target      " << _target.toString() << "\n";
+    out << "concurrency " << _concurrency << ", duration " << report.value("durationSeconds").toDouble() << "s\n";
+    QJsonObject byLabel = report.value("byContentType").toObject();
+    QStringList labels = QStringList() << "total" << byLabel.keys();
+    foreach (const QString &label, labels) {
+        QJsonObject stats = label == "total" ? report.value("total").toObject() : byLabel.value(label).toObject();
+        QJsonObject latency = stats.value("latencyMs").toObject();
+        out << "\n[" << label << "]\n";
+        out << "  requests   " << stats.value("requests").toInt() << " (ok " << stats.value("ok").toInt()
+            << ", errors " << stats.value("errors").toInt() << ", " << QString::number(stats.value("errorRate").toDouble() * 100,'f',2) << "%)\n";
+        out << "  throughput " << QString::number(stats.value("throughput").toDouble(),'f',2) << " req/s\n";
+        out << "  latency ms mean " << QString::number(latency.value("mean").toDouble(),'f',1)
+            << "  p50 " << QString::number(latency.value("p50").toDouble(),'f',1)
+            << "  p90 " << QString::number(latency.value("p90").toDouble(),'f',1)
+            << "  p99 " << QString::number(latency.value("p99").toDouble(),'f',1)
+            << "  p999 " << QString::number(latency.value("p999").toDouble(),'f',1)
+            << "  max " << QString::number(latency.value("max").toDouble(),'f',1) << "\n";
+        QJsonObject errors = stats.value("errorsByKind").toObject();
+        foreach (const QString &kind, errors.keys()) {
+            out << "  error " << kind << " " << errors.value(kind).toInt() << "\n";
+        }
+    }
+    out.flush();
+    return text;
+}
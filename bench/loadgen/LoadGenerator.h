@@ -0,0 +1,107 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QObject>
+#include <QUrl>
+#include <QMap>
+#include <QHash>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QJsonObject>
+#include "HttpClient.h"
+
+struct LoadRequest
+{
+    /**
+     * form encoded /doload params
+     * @brief body
+     */
+    QByteArray body;
+    QString label;
+    int weight;
+};
+
+struct LoadStats
+{
+    qint64 sent;
+    qint64 bytesIn;
+    QVector<qint64> latenciesUs;
+    QMap<int, qint64> statuses;
+    QMap<QString, qint64> errors;
+    LoadStats() : sent(0), bytesIn(0) {}
+};
+
+/**
+ * Keeps concurrency requests in flight against /doload for a fixed duration, every client
+ * has its own keep-alive connection and sends the next request as soon as one is answered.
+ */
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoadGenerator(QObject *parent = 0);
+    void setTarget(const QUrl &target);
+    void setConcurrency(int concurrency);
+    void setDuration(int seconds);
+    void setRequestTimeout(int ms);
+    void setSeed(uint seed);
+    void addRequest(const LoadRequest &request);
+    /**
+     * one request per line: weight, a tab or spaces, then the form encoded params,
+     * blank lines and lines starting with # are skipped
+     */
+    bool loadMix(const QString &path);
+    bool hasRequests();
+    void start();
+    QString textReport();
+    QJsonObject jsonReport();
+
+signals:
+    void done();
+
+private slots:
+    void clientFinished();
+    void stopSending();
+    void checkTimeouts();
+
+private:
+    void send(Pillow::HttpClient *client);
+    const LoadRequest& pickRequest();
+    void record(const QString &label, int status, const QString &error, qint64 latencyUs, qint64 bytes);
+    static QJsonObject statsJson(const LoadStats &stats, double seconds);
+    static qint64 percentile(const QVector<qint64> &sorted, double p);
+
+    QUrl _target;
+    int _concurrency;
+    int _durationSeconds;
+    int _requestTimeoutMs;
+    QVector<LoadRequest> _requests;
+    int _totalWeight;
+    QVector<Pillow::HttpClient*> _clients;
+    QHash<Pillow::HttpClient*, int> _inFlight;
+    QHash<Pillow::HttpClient*, qint64> _sentAt;
+    QElapsedTimer _clock;
+    QTimer _timeoutChecker;
+    bool _sending;
+    qint64 _elapsedMs;
+    LoadStats _total;
+    QMap<QString, LoadStats> _byLabel;
+};
+
+#endif // LOADGENERATOR_H
@@ -0,0 +1,15 @@
+QT += core network
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = seimiagent-loadgen
+DESTDIR = ../../bin
+
+SOURCES += main.cpp \
+    LoadGenerator.cpp
+
+HEADERS += \
+    LoadGenerator.h
+
+include(../../src/pillowcore/pillowcore.pri)
@@ -0,0 +1,103 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTextStream>
+#include "LoadGenerator.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("seimiagent-loadgen");
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives /doload of a running SeimiAgent with a fixed concurrency and reports throughput, latency percentiles and errors.");
+    parser.addHelpOption();
+    QCommandLineOption targetOption("target","The /doload url of the SeimiAgent under test,default http://127.0.0.1:8000/doload.","url","http://127.0.0.1:8000/doload");
+    QCommandLineOption concurrencyOption(QStringList() << "c" << "concurrency","Requests kept in flight,default 8.","n","8");
+    QCommandLineOption durationOption(QStringList() << "d" << "duration","How long to send requests,in seconds,default 30.","seconds","30");
+    QCommandLineOption timeoutOption("timeout","Abort a request after this many ms and count it as a timeout error,0(default) means never.","ms","0");
+    QCommandLineOption mixOption("mix","Request mix file,one `weight params` per line,params form encoded like `url=http%3A%2F%2Fexample.com&contentType=img`.","file");
+    QCommandLineOption urlOption("url","The page to render when no --mix is given.","url");
+    QCommandLineOption contentTypeOption("content-type","contentType of the requests built from --url,default html.","type","html");
+    QCommandLineOption renderTimeOption("render-time","renderTime of the requests built from --url,in ms.","ms");
+    QCommandLineOption seedOption("seed","Seed of the request mix picks,default the current time.","seed");
+    QCommandLineOption jsonOption("json","Also write the report as JSON to this file,`-` means stdout.","file");
+    parser.addOption(targetOption);
+    parser.addOption(concurrencyOption);
+    parser.addOption(durationOption);
+    parser.addOption(timeoutOption);
+    parser.addOption(mixOption);
+    parser.addOption(urlOption);
+    parser.addOption(contentTypeOption);
+    parser.addOption(renderTimeOption);
+    parser.addOption(seedOption);
+    parser.addOption(jsonOption);
+    parser.process(a);
+
+    QTextStream err(stderr);
+    LoadGenerator loadGenerator;
+    loadGenerator.setTarget(QUrl(parser.value(targetOption)));
+    loadGenerator.setConcurrency(parser.value(concurrencyOption).toInt());
+    loadGenerator.setDuration(parser.value(durationOption).toInt());
+    loadGenerator.setRequestTimeout(parser.value(timeoutOption).toInt());
+    loadGenerator.setSeed(parser.isSet(seedOption) ? parser.value(seedOption).toUInt() : uint(QDateTime::currentMSecsSinceEpoch()));
+    if(parser.isSet(mixOption)){
+        if(!loadGenerator.loadMix(parser.value(mixOption))){
+            err << "can not read mix file " << parser.value(mixOption) << endl;
+            return 1;
+        }
+    }else if(parser.isSet(urlOption)){
+        QByteArray body = "url=" + QUrl::toPercentEncoding(parser.value(urlOption))
+                + "&contentType=" + QUrl::toPercentEncoding(parser.value(contentTypeOption));
+        if(parser.isSet(renderTimeOption)){
+            body += "&renderTime=" + QUrl::toPercentEncoding(parser.value(renderTimeOption));
+        }
+        LoadRequest request;
+        request.body = body;
+        request.label = parser.value(contentTypeOption);
+        request.weight = 1;
+        loadGenerator.addRequest(request);
+    }
+    if(!loadGenerator.hasRequests()){
+        err << "nothing to send,give --url or a --mix file" << endl;
+        return 1;
+    }
+
+    QObject::connect(&loadGenerator,SIGNAL(done()),&a,SLOT(quit()));
+    loadGenerator.start();
+    a.exec();
+
+    QTextStream out(stdout);
+    out << loadGenerator.textReport();
+    out.flush();
+    if(parser.isSet(jsonOption)){
+        QByteArray json = QJsonDocument(loadGenerator.jsonReport()).toJson();
+        if(parser.value(jsonOption) == "-"){
+            out << json;
+        }else{
+            QFile file(parser.value(jsonOption));
+            if(!file.open(QIODevice::WriteOnly|QIODevice::Truncate)){
+                err << "can not write " << parser.value(jsonOption) << endl;
+                return 1;
+            }
+            file.write(json);
+        }
+    }
+    return 0;
+}
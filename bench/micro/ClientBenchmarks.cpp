@@ -0,0 +1,52 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <memory>
+#include "HttpClient.h"
+#include "PillowBenchmarks.h"
+
+namespace {
+QByteArray renderResponse(){
+    QByteArray body(2048,'x');
+    QByteArray response = "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: text/html;charset=utf-8\r\n"
+                          "Server-Timing: queue;dur=0, acquire;dur=1, ttfb;dur=35, load;dur=412, wait;dur=500, html;dur=12, encode;dur=1, total;dur=961\r\n"
+                          "Connection: keep-alive\r\n"
+                          "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+    return response + body;
+}
+}
+
+void addClientBenchmarks(BenchHarness &harness){
+    std::shared_ptr<Pillow::HttpResponseParser> parser(new Pillow::HttpResponseParser());
+    QByteArray response = renderResponse();
+    harness.add("HttpResponseParser/inject",[parser,response](int iterations, BenchTimer &){
+        for (int i = 0; i < iterations; ++i) {
+            // every inject is one complete keep-alive response, messageBegin clears the previous one
+            parser->inject(response);
+        }
+        BenchHarness::keep(&parser->content());
+    });
+    QByteArray head = response.left(response.indexOf("\r\n\r\n") + 4);
+    QByteArray body = response.mid(head.size());
+    harness.add("HttpResponseParser/inject_split",[parser,head,body](int iterations, BenchTimer &){
+        for (int i = 0; i < iterations; ++i) {
+            // headers and content arriving in two reads, as they usually do from a socket
+            parser->inject(head);
+            parser->inject(body);
+        }
+        BenchHarness::keep(&parser->content());
+    });
+}
@@ -0,0 +1,179 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <memory>
+#include <QBuffer>
+#include "parser/parser.h"
+#include "HttpConnection.h"
+#include "HttpHeader.h"
+#include "ByteArrayHelpers.h"
+#include "PillowBenchmarks.h"
+
+namespace {
+const char LOAD_BODY[] = "url=https%3A%2F%2Fwww.example.com%2Fsearch%3Fq%3Dseimi%2Bagent%26page%3D2&renderTime=3000"
+                         "&contentType=img&proxy=http%3A%2F%2Fuser%3Apass%40127.0.0.1%3A3128&useCookie=1"
+                         "&ua=Mozilla%2F5.0%20%28X11%3B%20Linux%20x86_64%29&resourceTimeout=20000";
+
+QByteArray loadHeaders(){
+    return QByteArray("Host: 127.0.0.1:8000\r\n"
+                      "User-Agent: Apache-HttpClient/4.5.2 (Java/1.8.0_101)\r\n"
+                      "Accept: */*\r\n"
+                      "Accept-Encoding: gzip,deflate\r\n"
+                      "Connection: keep-alive\r\n");
+}
+
+QByteArray loadPost(){
+    QByteArray body(LOAD_BODY);
+    return "POST /doload HTTP/1.1\r\n" + loadHeaders()
+            + "Content-Type: application/x-www-form-urlencoded\r\n"
+            + "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+}
+
+QByteArray loadGet(){
+    return "GET /doload?" + QByteArray(LOAD_BODY) + " HTTP/1.1\r\n" + loadHeaders() + "\r\n";
+}
+
+void noopField(void *, const char *, size_t, const char *, size_t){
+}
+
+/**
+ * An HttpConnection over in-memory devices. Every cycle() replays the same keep-alive request
+ * through processInput, the request handler answers it and the connection goes back to
+ * ReceivingHeaders, ready for the next cycle.
+ */
+class ConnectionRig
+{
+public:
+    explicit ConnectionRig(const QByteArray &request){
+        _input.setBuffer(&_request);
+        _input.open(QIODevice::ReadOnly);
+        _output.setBuffer(&_response);
+        _output.open(QIODevice::WriteOnly);
+        // the request is set after initialize so it does not schedule a processInput on the event loop
+        _connection.initialize(&_input,&_output);
+        _request = request;
+        QObject::connect(&_connection,&Pillow::HttpConnection::requestReady,[this](Pillow::HttpConnection *connection){
+            onRequest(connection);
+        });
+    }
+    void cycle(){
+        _input.seek(0);
+        _output.seek(0);
+        QMetaObject::invokeMethod(&_connection,"processInput",Qt::DirectConnection);
+    }
+    std::function<void(Pillow::HttpConnection*)> onRequest;
+
+private:
+    QByteArray _request;
+    QByteArray _response;
+    QBuffer _input;
+    QBuffer _output;
+    Pillow::HttpConnection _connection;
+};
+
+Pillow::HttpHeaderCollection responseHeaders(){
+    Pillow::HttpHeaderCollection headers;
+    headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
+    headers << Pillow::HttpHeader("Server-Timing", "queue;dur=0, acquire;dur=1, ttfb;dur=35, load;dur=412, wait;dur=500, html;dur=12, encode;dur=1, total;dur=961");
+    headers << Pillow::HttpHeader("ETag", "\"5d41402abc4b2a76b9719d911017c592\"");
+    headers << Pillow::HttpHeader("Cache-Control", "no-cache");
+    return headers;
+}
+}
+
+void addConnectionBenchmarks(BenchHarness &harness){
+    QByteArray post = loadPost();
+    QByteArray head = post.left(post.indexOf("\r\n\r\n") + 4);
+    harness.add("thin_http_parser_execute",[head](int iterations, BenchTimer &){
+        http_parser parser;
+        for (int i = 0; i < iterations; ++i) {
+            memset(&parser,0,sizeof(http_parser));
+            parser.http_field = &noopField;
+            thin_http_parser_init(&parser);
+            thin_http_parser_execute(&parser,head.constData(),head.size(),0);
+        }
+        BenchHarness::keep(&parser);
+    });
+
+    Pillow::HttpHeaderCollection headers = responseHeaders();
+    QByteArray content(4096,'x');
+
+    std::shared_ptr<ConnectionRig> cycleRig(new ConnectionRig(post));
+    cycleRig->onRequest = [headers,content](Pillow::HttpConnection *connection){
+        connection->writeResponse(200,headers,content);
+    };
+    harness.add("HttpConnection/cycle_post",[cycleRig](int iterations, BenchTimer &){
+        for (int i = 0; i < iterations; ++i) {
+            cycleRig->cycle();
+        }
+    });
+
+    // only the response write is timed, the request side is paused: the headers plus a 4KB body copied into the output buffer
+    std::shared_ptr<ConnectionRig> writeRig(new ConnectionRig(loadGet()));
+    std::shared_ptr<BenchTimer*> writeTimer(new BenchTimer*(0));
+    writeRig->onRequest = [headers,content,writeTimer](Pillow::HttpConnection *connection){
+        (*writeTimer)->start();
+        connection->writeResponse(200,headers,content);
+        (*writeTimer)->stop();
+    };
+    harness.add("HttpConnection::writeResponse_4k",[writeRig,writeTimer](int iterations, BenchTimer &timer){
+        timer.stop();
+        *writeTimer = &timer;
+        for (int i = 0; i < iterations; ++i) {
+            writeRig->cycle();
+        }
+        *writeTimer = 0;
+    });
+
+    std::shared_ptr<ConnectionRig> paramsRig(new ConnectionRig(post));
+    std::shared_ptr<BenchTimer*> paramsTimer(new BenchTimer*(0));
+    paramsRig->onRequest = [paramsTimer](Pillow::HttpConnection *connection){
+        (*paramsTimer)->start();
+        BenchHarness::keep(&connection->requestParams());
+        (*paramsTimer)->stop();
+        connection->writeResponse(200);
+    };
+    harness.add("HttpConnection::requestParams",[paramsRig,paramsTimer](int iterations, BenchTimer &timer){
+        timer.stop();
+        *paramsTimer = &timer;
+        for (int i = 0; i < iterations; ++i) {
+            paramsRig->cycle();
+        }
+        *paramsTimer = 0;
+    });
+
+    QByteArray encoded("https%3A%2F%2Fwww.example.com%2Fsearch%3Fq%3Dseimi%2Bagent%26page%3D2%26lang%3Dzh-CN%26ref%3Dhome");
+    harness.add("ByteArrayHelpers::percentDecode",[encoded](int iterations, BenchTimer &){
+        for (int i = 0; i < iterations; ++i) {
+            QString decoded = Pillow::ByteArrayHelpers::percentDecode(encoded);
+            BenchHarness::keep(decoded.constData());
+        }
+    });
+
+    Pillow::HttpHeaderCollection requestHeaders;
+    QList<QByteArray> lines = post.left(post.indexOf("\r\n\r\n")).split('\n');
+    for (int i = 1; i < lines.size(); ++i) {
+        QByteArray line = lines.at(i).trimmed();
+        int colon = line.indexOf(':');
+        requestHeaders << Pillow::HttpHeader(line.left(colon),line.mid(colon + 1).trimmed());
+    }
+    harness.add("HttpHeaderCollection::getFieldValue",[requestHeaders](int iterations, BenchTimer &){
+        for (int i = 0; i < iterations; ++i) {
+            // a hit near the end, as for content-length, and a miss
+            BenchHarness::keep(&requestHeaders.getFieldValue("content-length"));
+            BenchHarness::keep(&requestHeaders.getFieldValue("expect"));
+        }
+    });
+}
@@ -0,0 +1,31 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef PILLOWBENCHMARKS_H
+#define PILLOWBENCHMARKS_H
+
+#include "BenchHarness.h"
+
+/**
+ * request side: the thin request parser, HttpConnection request/response cycle, params and headers
+ */
+void addConnectionBenchmarks(BenchHarness &harness);
+/**
+ * response side: HttpResponseParser as driven by HttpClient. Kept in its own file because the
+ * joyent parser it uses declares an http_parser of its own.
+ */
+void addClientBenchmarks(BenchHarness &harness);
+
+#endif // PILLOWBENCHMARKS_H
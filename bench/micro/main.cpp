@@ -0,0 +1,27 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QCoreApplication>
+#include "PillowBenchmarks.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("seimiagent-microbench");
+    BenchHarness harness;
+    addConnectionBenchmarks(harness);
+    addClientBenchmarks(harness);
+    return benchMain(harness,"Micro-benchmarks of the pillowcore code every /doload request goes through,reported as ns/op and allocs/op.");
+}
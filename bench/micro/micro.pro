@@ -0,0 +1,17 @@
+QT += core network
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = seimiagent-microbench
+DESTDIR = ../../bin
+
+SOURCES += main.cpp \
+    ConnectionBenchmarks.cpp \
+    ClientBenchmarks.cpp
+
+HEADERS += \
+    PillowBenchmarks.h
+
+include(../common/common.pri)
+include(../../src/pillowcore/pillowcore.pri)
@@ -0,0 +1,171 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <memory>
+#include <QApplication>
+#include <QBuffer>
+#include <QEventLoop>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QUrl>
+#include "SeimiWebPage.h"
+#include "PngParallelEncoder.h"
+#include "BenchHarness.h"
+
+namespace {
+const int PageWidth = 1280;
+
+/**
+ * A page of about height px: blocks of text, gradients, borders and shadows, the usual
+ * things that make a real page expensive to paint.
+ */
+QByteArray fixtureHtml(int height){
+    QByteArray html = "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><style>\n"
+                      "body{margin:0;width:1280px;font:14px/1.5 sans-serif;color:#222}\n"
+                      ".b{box-sizing:border-box;height:200px;margin:0;padding:16px 24px;border-bottom:1px solid #ddd;overflow:hidden}\n"
+                      ".b:nth-child(odd){background:linear-gradient(90deg,#f6f8fa,#e1e4e8)}\n"
+                      ".c{float:right;width:160px;height:120px;border-radius:8px;box-shadow:0 2px 6px rgba(0,0,0,.3);background:#4a90d9}\n"
+                      "</style></head><body>\n";
+    for (int i = 0; i < height / 200; ++i) {
+        html += "<div class=\"b\"><div class=\"c\"></div><h3>Block " + QByteArray::number(i) + "</h3><p>";
+        for (int w = 0; w < 60; ++w) {
+            html += "seimi agent render ";
+        }
+        html += "</p></div>\n";
+    }
+    html += "</body></html>\n";
+    return html;
+}
+
+std::shared_ptr<SeimiPage> loadFixture(const QTemporaryDir &dir, int height){
+    QString path = dir.path() + QString("/fixture_%1.html").arg(height);
+    QFile file(path);
+    file.open(QIODevice::WriteOnly|QIODevice::Truncate);
+    file.write(fixtureHtml(height));
+    file.close();
+    std::shared_ptr<SeimiPage> page(new SeimiPage());
+    QEventLoop eventLoop;
+    QObject::connect(page.get(),SIGNAL(loadOver()),&eventLoop,SLOT(quit()));
+    page->toLoad(QUrl::fromLocalFile(path).toString(),0,"SeimiAgent-renderbench",20000);
+    eventLoop.exec();
+    return page;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication a(argc, argv);
+    QApplication::setApplicationName("seimiagent-renderbench");
+    QTemporaryDir dir;
+    if(!dir.isValid()){
+        QTextStream(stderr) << "can not create a temporary directory" << endl;
+        return 1;
+    }
+    BenchHarness harness;
+    QList<int> heights = QList<int>() << 1000 << 5000 << 20000;
+    QList<int> tileSizes = QList<int>() << 1024 << 2048 << 4096;
+    foreach (int height, heights) {
+        std::shared_ptr<SeimiPage> page = loadFixture(dir,height);
+        QString suffix = QString("/h%1").arg(height);
+        harness.add("toHtml" + suffix,[page](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QString html = page->mainFrame()->toHtml();
+                BenchHarness::keep(html.constData());
+            }
+        });
+        foreach (int tileSize, tileSizes) {
+            harness.add(QString("renderImg%1/tile%2").arg(suffix).arg(tileSize),[page,height,tileSize](int iterations, BenchTimer &){
+                for (int i = 0; i < iterations; ++i) {
+                    QSize targetSize(PageWidth,height);
+                    QImage img = page->renderImg(targetSize,tileSize);
+                    BenchHarness::keep(img.constBits());
+                }
+            });
+        }
+        QSize targetSize(PageWidth,height);
+        std::shared_ptr<QImage> img(new QImage(page->renderImg(targetSize)));
+        harness.add("png" + suffix,[img](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QByteArray out;
+                QBuffer buffer(&out);
+                buffer.open(QIODevice::WriteOnly);
+                img->save(&buffer,"png",-1);
+                BenchHarness::keep(out.constData());
+            }
+        });
+        harness.add("pngParallel" + suffix,[img](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QByteArray out = PngParallelEncoder::encode(*img);
+                BenchHarness::keep(out.constData());
+            }
+        });
+        harness.add("generateImg" + suffix,[page,height](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QSize targetSize(PageWidth,height);
+                QByteArray out = page->generateImg(targetSize);
+                BenchHarness::keep(out.constData());
+            }
+        });
+        harness.add("thumb" + suffix,[page,height](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QSize targetSize(PageWidth,height);
+                QByteArray out = page->generateImg(targetSize,-1,0.25);
+                BenchHarness::keep(out.constData());
+            }
+        });
+        harness.add("viewports" + suffix,[page](int iterations, BenchTimer &){
+            static const int widths[] = {375, 768, 1440};
+            for (int i = 0; i < iterations; ++i) {
+                QSize oriViewportSize = page->viewportSize();
+                for (int width : widths) {
+                    QSize targetSize = page->relayout(width);
+                    QByteArray out = page->generateImg(targetSize);
+                    BenchHarness::keep(out.constData());
+                }
+                page->setViewportSize(oriViewportSize);
+            }
+        });
+        harness.add("generateJpeg" + suffix,[page,height](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QSize targetSize(PageWidth,height);
+                QByteArray out = page->generateJpeg(targetSize);
+                BenchHarness::keep(out.constData());
+            }
+        });
+        harness.add("streamImg" + suffix,[page,height](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QSize targetSize(PageWidth,height);
+                page->streamImg(targetSize,[](const QByteArray &chunk){
+                    BenchHarness::keep(chunk.constData());
+                    return true;
+                });
+            }
+        });
+        harness.add("generatePdf" + suffix,[page](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QByteArray out = page->generatePdf();
+                BenchHarness::keep(out.constData());
+            }
+        });
+        harness.add("generatePdfDpi150" + suffix,[page](int iterations, BenchTimer &){
+            for (int i = 0; i < iterations; ++i) {
+                QByteArray out = page->generatePdf(QPageSize::A4,QPageLayout::Portrait,150);
+                BenchHarness::keep(out.constData());
+            }
+        });
+    }
+    return benchMain(harness,"Times every stage of the SeimiPage render pipeline on local fixture pages of several heights.");
+}
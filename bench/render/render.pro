@@ -0,0 +1,40 @@
+QT += webkitwidgets network printsupport
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = seimiagent-renderbench
+DESTDIR = ../../bin
+INCLUDEPATH += ../../src
+
+SOURCES += main.cpp \
+    ../../src/SeimiWebPage.cpp \
+    ../../src/NetworkAccessManager.cpp \
+    ../../src/cookiejar.cpp \
+    ../../src/TimerWheel.cpp \
+    ../../src/SeimiMetrics.cpp \
+    ../../src/SeimiTracer.cpp \
+    ../../src/SeimiLoopMonitor.cpp \
+    ../../src/SeimiLog.cpp \
+    ../../src/PngStreamEncoder.cpp \
+    ../../src/PngParallelEncoder.cpp \
+    ../../src/PdfImageCap.cpp
+
+HEADERS += \
+    ../../src/SeimiWebPage.h \
+    ../../src/NetworkAccessManager.h \
+    ../../src/cookiejar.h \
+    ../../src/TimerWheel.h \
+    ../../src/SeimiMetrics.h \
+    ../../src/SeimiTracer.h \
+    ../../src/SeimiLoopMonitor.h \
+    ../../src/SeimiLog.h \
+    ../../src/PngStreamEncoder.h \
+    ../../src/PngParallelEncoder.h \
+    ../../src/PdfImageCap.h
+
+include(../common/common.pri)
+include(../../src/pillowcore/pillowcore.pri)
+
+# the PNG encoders call zlib directly, pillowcore only ships its headers
+isEmpty(PILLOW_ZLIB_LIBS): PILLOW_ZLIB_LIBS = -lz
+LIBS += $$PILLOW_ZLIB_LIBS
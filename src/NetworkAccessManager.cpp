@@ -18,16 +18,20 @@
 #include <QNetworkDiskCache>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QNetworkProxy>
 #include <QSslError>
 #include <QStandardPaths>
 #include <QString>
 #include <QDebug>
+#include <QJsonObject>
+#include "SeimiMetrics.h"
+#include "SeimiTracer.h"
 
 NetworkAccessManager::NetworkAccessManager(QObject *parent)
     : QNetworkAccessManager(parent),
     requestFinishedCount(0), requestFinishedFromCacheCount(0), requestFinishedPipelinedCount(0),
     requestFinishedSecureCount(0), requestFinishedDownloadBufferCount(0),_ua("Mozilla/5.0 (Windows NT 6.1; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/51.0.2704.84 Safari/537.36"),
-    _resourceTimeout(20000)
+    _resourceTimeout(20000), _proxyErrorCount(0), _proxyConnectTimeout(0), _proxyConnectTimer(0), _deadlineTimer(0), _deadlineMs(0), _deadlineExceeded(false), _mainRequested(false), _recordResources(false), _recordFull(false)
 {
     connect(this, SIGNAL(finished(QNetworkReply*)),
             SLOT(requestFinished(QNetworkReply*)));
@@ -41,9 +45,17 @@ NetworkAccessManager::NetworkAccessManager(QObject *parent)
     setCache(diskCache);
 }
 
-RequestTimer::RequestTimer(QObject* parent)
-    : QTimer(parent)
+NetworkAccessManager::~NetworkAccessManager()
 {
+    // the wheel keeps raw pointers to us, drop them before going away
+    TimerWheel *wheel = TimerWheel::instance();
+    foreach (const PendingReply &pending, _pendingReplies) {
+        wheel->cancel(pending.timer);
+    }
+    if (_deadlineTimer)
+        wheel->cancel(_deadlineTimer);
+    if (_proxyConnectTimer)
+        wheel->cancel(_proxyConnectTimer);
 }
 
 QNetworkReply* NetworkAccessManager::createRequest(Operation op, const QNetworkRequest & req, QIODevice * outgoingData)
@@ -52,33 +64,89 @@ QNetworkReply* NetworkAccessManager::createRequest(Operation op, const QNetworkR
     request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
     request.setRawHeader("User-Agent",_ua.toUtf8());
     QNetworkReply* reply = QNetworkAccessManager::createRequest(op, request, outgoingData);
+    if (SeimiTracer::isEnabled())
+        SeimiTracer::asyncBegin("network", "resource", reply, request.url().toEncoded());
 
-    RequestTimer* rt = new RequestTimer(reply);
-    rt->reply = reply;
-    rt->setInterval(_resourceTimeout);
-    rt->setSingleShot(true);
-    rt->start();
-
-    connect(rt, SIGNAL(timeout()), this, SLOT(resourceTimeout()));
+    int timeout = _resourceTimeout;
+    if (_deadlineMs > 0)
+        timeout = qBound(1, int(_deadlineMs - _deadlineClock.elapsed()), timeout);
+    PendingReply pending;
+    pending.reply = reply;
+    pending.timer = TimerWheel::instance()->schedule(timeout, this, quintptr(reply));
+    pending.bytesReceived = 0;
+    pending.startedAt = -1;
+    pending.firstByteAt = -1;
+    pending.requestBodySize = -1;
+    pending.abortCause = NULL;
+    if (_recordResources) {
+        if (_recordFull)
+            pending.startedDateTime = QDateTime::currentDateTimeUtc();
+        pending.startedAt = _recordClock.elapsed();
+        pending.requestBodySize = outgoingData ? outgoingData->size() : 0;
+        connect(reply, SIGNAL(metaDataChanged()), SLOT(replyMetaData()));
+    }
+    _pendingReplies.insert(reply, pending);
+    // a reply deleted before it finished must not be left to the wheel nor to abortPendingReplies
+    connect(reply, SIGNAL(destroyed(QObject*)), SLOT(replyDestroyed(QObject*)));
+    connect(reply, SIGNAL(downloadProgress(qint64,qint64)), SLOT(replyDownloadProgress(qint64,qint64)));
+    if (!_mainRequested) {
+        // the main frame document is always the first request of a render
+        _mainRequested = true;
+        _mainReply = reply;
+        connect(reply, SIGNAL(metaDataChanged()), SLOT(mainReplyMetaData()));
+        if (_proxyConnectTimeout > 0 && proxy().type() != QNetworkProxy::NoProxy)
+            _proxyConnectTimer = TimerWheel::instance()->schedule(qMin(_proxyConnectTimeout, timeout), this, ProxyConnectCookie);
+    }
 
     return reply;
 }
 
 void NetworkAccessManager::requestFinished(QNetworkReply *reply)
 {
+    SeimiTracer::asyncEnd("network", "resource", reply);
+    SeimiMetrics *metrics = SeimiMetrics::instance();
+    QHash<QNetworkReply*, PendingReply>::iterator pending = _pendingReplies.find(reply);
+    if (pending != _pendingReplies.end()) {
+        TimerWheel::instance()->cancel(pending->timer);
+        metrics->add(SeimiMetrics::NetworkBytesIn, pending->bytesReceived);
+        if (_recordResources)
+            recordResource(reply, pending.value());
+        _pendingReplies.erase(pending);
+    }
+    if (reply == _mainReply && _proxyConnectTimer) {
+        TimerWheel::instance()->cancel(_proxyConnectTimer);
+        _proxyConnectTimer = 0;
+    }
+
     requestFinishedCount++;
+    metrics->add(SeimiMetrics::NetworkRequests);
+
+    if ((reply->error() >= QNetworkReply::ProxyConnectionRefusedError && reply->error() <= QNetworkReply::ProxyAuthenticationRequiredError)
+            || reply->error() == QNetworkReply::UnknownProxyError) {
+        proxyError();
+    } else if (reply->error() != QNetworkReply::NoError && reply->error() != QNetworkReply::OperationCanceledError) {
+        metrics->error(SeimiMetrics::ErrorNetwork);
+    }
 
-    if (reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool() == true)
+    if (reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool() == true) {
         requestFinishedFromCacheCount++;
+        metrics->add(SeimiMetrics::NetworkRequestsFromCache);
+    }
 
-    if (reply->attribute(QNetworkRequest::HttpPipeliningWasUsedAttribute).toBool() == true)
+    if (reply->attribute(QNetworkRequest::HttpPipeliningWasUsedAttribute).toBool() == true) {
         requestFinishedPipelinedCount++;
+        metrics->add(SeimiMetrics::NetworkRequestsPipelined);
+    }
 
-    if (reply->attribute(QNetworkRequest::ConnectionEncryptedAttribute).toBool() == true)
+    if (reply->attribute(QNetworkRequest::ConnectionEncryptedAttribute).toBool() == true) {
         requestFinishedSecureCount++;
+        metrics->add(SeimiMetrics::NetworkRequestsSecure);
+    }
 
-    if (reply->attribute(QNetworkRequest::DownloadBufferAttribute).isValid() == true)
+    if (reply->attribute(QNetworkRequest::DownloadBufferAttribute).isValid() == true) {
         requestFinishedDownloadBufferCount++;
+        metrics->add(SeimiMetrics::NetworkRequestsDownloadBuffer);
+    }
 
     if (requestFinishedCount % 10)
         return;
@@ -112,14 +180,232 @@ void NetworkAccessManager::setCurrentUrl(const QString &current){
     _currentMainTarget = current;
 }
 
-void NetworkAccessManager::resourceTimeout(){
-    RequestTimer* rt = qobject_cast<RequestTimer*>(sender());
-    if (!rt->reply) {
+void NetworkAccessManager::proxyError(){
+    _proxyErrorCount++;
+    SeimiMetrics::instance()->error(SeimiMetrics::ErrorProxy);
+    if (_proxyErrorCount == 1)
+        emit proxyFailed();
+}
+
+void NetworkAccessManager::wheelTimeout(quintptr cookie){
+    if(cookie == ProxyConnectCookie){
+        _proxyConnectTimer = 0;
+        if(_mainReply.isNull() || !_pendingReplies.contains(_mainReply)){
+            return;
+        }
+        qInfo("[seimi] TargetUrl[%s] no response through the proxy within %dms, abort.",_currentMainTarget.toUtf8().constData(),_proxyConnectTimeout);
+        _pendingReplies[_mainReply].abortCause = "proxy";
+        proxyError();
+        _mainReply->abort();
+        return;
+    }
+    if(cookie == DeadlineCookie){
+        _deadlineTimer = 0;
+        _deadlineExceeded = true;
+        qInfo("[seimi] TargetUrl[%s] render deadline(%dms) exceeded, abort %d pending requests.",_currentMainTarget.toUtf8().constData(),_deadlineMs,_pendingReplies.size());
+        abortPendingReplies();
+        emit renderDeadlineExceeded();
         return;
     }
+    QHash<QNetworkReply*, PendingReply>::iterator pending = _pendingReplies.find(reinterpret_cast<QNetworkReply*>(cookie));
+    if (pending == _pendingReplies.end()) {
+        return;
+    }
+    QPointer<QNetworkReply> reply = pending->reply;
+    if (reply.isNull()) {
+        _pendingReplies.erase(pending);
+        return;
+    }
+    pending->abortCause = "timeout";
+    SeimiMetrics::instance()->error(SeimiMetrics::ErrorResourceTimeout);
     // Abort the reply that we attached to the Network Timeout
-    qInfo("[seimi] Resource[%s] request timeout.",rt->reply->request().url().toString().toUtf8().constData());
-    rt->reply->abort();
+    qInfo("[seimi] Resource[%s] request timeout.",reply->request().url().toString().toUtf8().constData());
+    reply->abort();
+}
+
+void NetworkAccessManager::replyDownloadProgress(qint64 bytesReceived, qint64){
+    QHash<QNetworkReply*, PendingReply>::iterator pending = _pendingReplies.find(static_cast<QNetworkReply*>(sender()));
+    if (pending != _pendingReplies.end())
+        pending->bytesReceived = bytesReceived;
+}
+
+void NetworkAccessManager::replyDestroyed(QObject *reply){
+    // only the address is left, it is never dereferenced
+    QHash<QNetworkReply*, PendingReply>::iterator pending = _pendingReplies.find(reinterpret_cast<QNetworkReply*>(reply));
+    if (pending != _pendingReplies.end()) {
+        TimerWheel::instance()->cancel(pending->timer);
+        _pendingReplies.erase(pending);
+    }
+}
+
+void NetworkAccessManager::mainReplyMetaData(){
+    QNetworkReply* reply = static_cast<QNetworkReply*>(sender());
+    disconnect(reply, SIGNAL(metaDataChanged()), this, SLOT(mainReplyMetaData()));
+    if (_proxyConnectTimer) {
+        TimerWheel::instance()->cancel(_proxyConnectTimer);
+        _proxyConnectTimer = 0;
+    }
+    emit mainDocumentResponded();
+}
+
+void NetworkAccessManager::replyMetaData(){
+    QNetworkReply* reply = static_cast<QNetworkReply*>(sender());
+    QHash<QNetworkReply*, PendingReply>::iterator pending = _pendingReplies.find(reply);
+    // redirects and 100-continue may update the meta data again, keep the first one
+    if (pending != _pendingReplies.end() && pending->firstByteAt < 0)
+        pending->firstByteAt = _recordClock.elapsed();
+}
+
+static QString methodOf(QNetworkReply *reply){
+    switch (reply->operation()) {
+    case QNetworkAccessManager::HeadOperation: return "HEAD";
+    case QNetworkAccessManager::PutOperation: return "PUT";
+    case QNetworkAccessManager::PostOperation: return "POST";
+    case QNetworkAccessManager::DeleteOperation: return "DELETE";
+    case QNetworkAccessManager::CustomOperation: return QString::fromLatin1(reply->request().attribute(QNetworkRequest::CustomVerbAttribute).toByteArray());
+    default: return "GET";
+    }
+}
+
+void NetworkAccessManager::recordResource(QNetworkReply *reply, const PendingReply &pending){
+    ResourceRecord record;
+    const QNetworkRequest &request = reply->request();
+    record.url = reply->url();
+    record.status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (_recordFull) {
+        record.method = methodOf(reply);
+        foreach (const QByteArray &name, request.rawHeaderList()) {
+            record.requestHeaders.append(QNetworkReply::RawHeaderPair(name, request.rawHeader(name)));
+        }
+        record.responseHeaders = reply->rawHeaderPairs();
+        record.statusText = reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute).toString();
+        record.mimeType = reply->header(QNetworkRequest::ContentTypeHeader).toString();
+        record.redirectUrl = reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl();
+    }
+    record.startedDateTime = pending.startedDateTime;
+    record.startedAt = pending.startedAt;
+    record.finishedAt = _recordClock.elapsed();
+    record.firstByteAt = pending.firstByteAt < 0 ? record.finishedAt : pending.firstByteAt;
+    record.requestBodySize = pending.requestBodySize;
+    record.bytesReceived = pending.bytesReceived;
+    record.fromCache = reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool();
+    record.abortCause = pending.abortCause;
+    if (reply->error() != QNetworkReply::NoError)
+        record.error = reply->errorString();
+    _resourceRecords.append(record);
+}
+
+void NetworkAccessManager::setRecordResources(bool recordResources, bool fullRecords){
+    _recordResources = recordResources;
+    _recordFull = recordResources && fullRecords;
+    if (recordResources)
+        _recordClock.start();
+}
+
+const QVector<ResourceRecord>& NetworkAccessManager::resourceRecords(){
+    return _resourceRecords;
+}
+
+static QJsonArray harHeaders(const QList<QNetworkReply::RawHeaderPair> &rawHeaders){
+    QJsonArray headers;
+    foreach (const QNetworkReply::RawHeaderPair &header, rawHeaders) {
+        QJsonObject item;
+        item.insert("name", QString::fromLatin1(header.first));
+        item.insert("value", QString::fromLatin1(header.second));
+        headers.append(item);
+    }
+    return headers;
+}
+
+QJsonArray NetworkAccessManager::harEntries(){
+    QJsonArray entries;
+    foreach (const ResourceRecord &record, _resourceRecords) {
+        QJsonObject harRequest;
+        harRequest.insert("method", record.method);
+        harRequest.insert("url", record.url.toString());
+        harRequest.insert("httpVersion", "HTTP/1.1");
+        harRequest.insert("cookies", QJsonArray());
+        harRequest.insert("headers", harHeaders(record.requestHeaders));
+        harRequest.insert("queryString", QJsonArray());
+        harRequest.insert("headersSize", -1);
+        harRequest.insert("bodySize", record.requestBodySize);
+
+        QJsonObject content;
+        content.insert("size", record.bytesReceived);
+        content.insert("mimeType", record.mimeType);
+        QJsonObject harResponse;
+        // an aborted request has no response even when its headers had arrived
+        harResponse.insert("status", record.abortCause ? 0 : record.status);
+        harResponse.insert("statusText", record.abortCause ? QString() : record.statusText);
+        harResponse.insert("httpVersion", "HTTP/1.1");
+        harResponse.insert("cookies", QJsonArray());
+        harResponse.insert("headers", harHeaders(record.responseHeaders));
+        harResponse.insert("content", content);
+        harResponse.insert("redirectURL", record.redirectUrl.toString());
+        harResponse.insert("headersSize", -1);
+        harResponse.insert("bodySize", record.status == 304 ? 0 : record.bytesReceived);
+
+        // QNetworkAccessManager does not expose dns, connect and ssl times
+        QJsonObject timings;
+        timings.insert("blocked", -1);
+        timings.insert("dns", -1);
+        timings.insert("connect", -1);
+        timings.insert("send", 0);
+        timings.insert("wait", record.firstByteAt - record.startedAt);
+        timings.insert("receive", record.finishedAt - record.firstByteAt);
+
+        QJsonObject entry;
+        entry.insert("pageref", "page_1");
+        entry.insert("startedDateTime", record.startedDateTime.toString("yyyy-MM-dd'T'HH:mm:ss.zzz'Z'"));
+        entry.insert("time", record.finishedAt - record.startedAt);
+        entry.insert("request", harRequest);
+        entry.insert("response", harResponse);
+        entry.insert("cache", QJsonObject());
+        entry.insert("timings", timings);
+        entry.insert("_fromCache", record.fromCache);
+        if (record.abortCause) {
+            entry.insert("_abortCause", QString::fromLatin1(record.abortCause));
+            entry.insert("_error", record.error.isEmpty() ? QString("aborted") : record.error);
+        } else if (!record.error.isEmpty()) {
+            entry.insert("_error", record.error);
+        }
+        entries.append(entry);
+    }
+    return entries;
+}
+
+void NetworkAccessManager::setRenderDeadline(int deadlineMs){
+    if(deadlineMs <= 0){
+        return;
+    }
+    TimerWheel *wheel = TimerWheel::instance();
+    if(_deadlineTimer){
+        wheel->cancel(_deadlineTimer);
+    }
+    _deadlineMs = deadlineMs;
+    _deadlineExceeded = false;
+    _deadlineClock.start();
+    _deadlineTimer = wheel->schedule(deadlineMs, this, DeadlineCookie);
+}
+
+bool NetworkAccessManager::isDeadlineExceeded(){
+    return _deadlineExceeded;
+}
+
+void NetworkAccessManager::abortPendingReplies(){
+    // abort() emits finished synchronously which removes the reply from the map
+    for (QHash<QNetworkReply*, PendingReply>::iterator it = _pendingReplies.begin(); it != _pendingReplies.end(); ++it) {
+        if (!it->abortCause)
+            it->abortCause = _deadlineExceeded ? "deadline" : "cancelled";
+    }
+    QList<QPointer<QNetworkReply> > replies;
+    foreach (const PendingReply &pending, _pendingReplies) {
+        replies.append(pending.reply);
+    }
+    foreach (const QPointer<QNetworkReply> &reply, replies) {
+        if (!reply.isNull() && _pendingReplies.contains(reply))
+            reply->abort();
+    }
 }
 
 void NetworkAccessManager::setUserAgent(const QString &ua){
@@ -128,6 +414,14 @@ void NetworkAccessManager::setUserAgent(const QString &ua){
     }
 }
 
+void NetworkAccessManager::setProxyConnectTimeout(int timeoutMs){
+    _proxyConnectTimeout = timeoutMs;
+}
+
+int NetworkAccessManager::proxyErrorCount(){
+    return _proxyErrorCount;
+}
+
 void NetworkAccessManager::setResourceTimeout(int resourceTimeout){
     if(resourceTimeout > 0){
         _resourceTimeout = resourceTimeout;
@@ -19,19 +19,94 @@
 
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
-#include <QTimer>
-class NetworkAccessManager : public QNetworkAccessManager
+#include <QHash>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QVector>
+#include <QNetworkReply>
+#include <QPointer>
+#include "TimerWheel.h"
+
+struct PendingReply
+{
+    /**
+     * the map and the wheel are keyed by the raw pointer, only ever dereference this one
+     */
+    QPointer<QNetworkReply> reply;
+    TimerWheel::TimerId timer;
+    qint64 bytesReceived;
+    /**
+     * only tracked while resources are recorded
+     */
+    QDateTime startedDateTime;
+    qint64 startedAt;
+    qint64 firstByteAt;
+    qint64 requestBodySize;
+    const char *abortCause;
+};
+
+/**
+ * what is kept of a finished request while resources are recorded, turned into json only when asked for
+ */
+struct ResourceRecord
+{
+    QUrl url;
+    QString method;
+    QList<QNetworkReply::RawHeaderPair> requestHeaders;
+    QList<QNetworkReply::RawHeaderPair> responseHeaders;
+    int status;
+    QString statusText;
+    QString mimeType;
+    QUrl redirectUrl;
+    QDateTime startedDateTime;
+    qint64 startedAt;
+    qint64 firstByteAt;
+    qint64 finishedAt;
+    qint64 requestBodySize;
+    qint64 bytesReceived;
+    bool fromCache;
+    const char *abortCause;
+    QString error;
+};
+
+class NetworkAccessManager : public QNetworkAccessManager, public TimerWheelClient
 {
     Q_OBJECT
 
 public:
     NetworkAccessManager(QObject *parent = 0);
+    ~NetworkAccessManager();
     virtual QNetworkReply* createRequest ( Operation op, const QNetworkRequest & req, QIODevice * outgoingData = 0 );
     void setCurrentUrl(const QString &current);
     void setUserAgent(const QString &ua);
     void setResourceTimeout(int resourceTimeout);
+    int proxyErrorCount();
+    /**
+     * abort every pending request once the whole render has taken deadlineMs,
+     * requests issued later get what is left of it as their timeout.
+     */
+    void setRenderDeadline(int deadlineMs);
+    /**
+     * abort the main document when nothing came back through the proxy within timeoutMs, so that a dead proxy fails fast
+     */
+    void setProxyConnectTimeout(int timeoutMs);
+    bool isDeadlineExceeded();
+    void abortPendingReplies();
+    void wheelTimeout(quintptr cookie);
+    /**
+     * keep a ResourceRecord of every finished request. Without fullRecords only url, status, sizes, timings and
+     * errors are kept, not enough for harEntries
+     */
+    void setRecordResources(bool recordResources, bool fullRecords = true);
+    const QVector<ResourceRecord>& resourceRecords();
+    /**
+     * HAR 1.2 entries of the recorded resources
+     */
+    QJsonArray harEntries();
 
 private:
+    enum { DeadlineCookie = 0, ProxyConnectCookie = 1 };
     QList<QString> sslTrustedHostList;
     qint64 requestFinishedCount;
     qint64 requestFinishedFromCacheCount;
@@ -41,23 +116,42 @@ private:
     QString _currentMainTarget;
     QString _ua;
     int _resourceTimeout;
+    int _proxyErrorCount;
+    int _proxyConnectTimeout;
+    TimerWheel::TimerId _proxyConnectTimer;
+    QPointer<QNetworkReply> _mainReply;
+    QHash<QNetworkReply*, PendingReply> _pendingReplies;
+    TimerWheel::TimerId _deadlineTimer;
+    QElapsedTimer _deadlineClock;
+    int _deadlineMs;
+    bool _deadlineExceeded;
+    bool _mainRequested;
+    bool _recordResources;
+    bool _recordFull;
+    QElapsedTimer _recordClock;
+    QVector<ResourceRecord> _resourceRecords;
+    void recordResource(QNetworkReply *reply, const PendingReply &pending);
+    void proxyError();
 signals:
     void resourceTimeOut();
+    void renderDeadlineExceeded();
+    /**
+     * the headers of the main document have arrived, fired once per render
+     */
+    void mainDocumentResponded();
+    /**
+     * a request failed because of the proxy, fired once per render as soon as it happens
+     */
+    void proxyFailed();
 public slots:
     void requestFinished(QNetworkReply *reply);
-    void resourceTimeout();
+    void mainReplyMetaData();
+    void replyMetaData();
+    void replyDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void replyDestroyed(QObject *reply);
 
 #ifndef QT_NO_OPENSSL
     void sslErrors(QNetworkReply *reply, const QList<QSslError> &error);
 #endif
 };
-
-class RequestTimer : public QTimer
-{
-    Q_OBJECT
-
-public:
-    RequestTimer(QObject* parent = 0);
-    QNetworkReply* reply;
-};
 #endif // NETWORKACCESSMANAGER_H
@@ -0,0 +1,189 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QtMath>
+#include "PdfImageCap.h"
+
+PdfImageCapEngine::PdfImageCapEngine(QPainter *target, qreal targetDpi, qreal maxDpi) :
+    QPaintEngine(QPaintEngine::AllFeatures),
+    _target(target),
+    _targetDpi(targetDpi),
+    _maxDpi(maxDpi)
+{
+}
+
+bool PdfImageCapEngine::begin(QPaintDevice *){
+    _baseTransform = _target->transform();
+    _transform = _baseTransform;
+    return _target->isActive();
+}
+
+bool PdfImageCapEngine::end(){
+    _scaled.clear();
+    return true;
+}
+
+void PdfImageCapEngine::updateState(const QPaintEngineState &state){
+    QPaintEngine::DirtyFlags flags = state.state();
+    // the transform goes first, clips are given in the coordinates current when they are set
+    if(flags & QPaintEngine::DirtyTransform){
+        _transform = state.transform() * _baseTransform;
+        _target->setTransform(_transform);
+    }
+    if(flags & QPaintEngine::DirtyPen){
+        _target->setPen(state.pen());
+    }
+    if(flags & QPaintEngine::DirtyBrush){
+        _target->setBrush(state.brush());
+    }
+    if(flags & QPaintEngine::DirtyBrushOrigin){
+        _target->setBrushOrigin(state.brushOrigin());
+    }
+    if(flags & QPaintEngine::DirtyBackground){
+        _target->setBackground(state.backgroundBrush());
+    }
+    if(flags & QPaintEngine::DirtyBackgroundMode){
+        _target->setBackgroundMode(state.backgroundMode());
+    }
+    if(flags & QPaintEngine::DirtyFont){
+        _target->setFont(state.font());
+    }
+    if(flags & QPaintEngine::DirtyClipRegion){
+        _target->setClipRegion(state.clipRegion(), state.clipOperation());
+    }
+    if(flags & QPaintEngine::DirtyClipPath){
+        _target->setClipPath(state.clipPath(), state.clipOperation());
+    }
+    if(flags & QPaintEngine::DirtyClipEnabled){
+        _target->setClipping(state.isClipEnabled());
+    }
+    if(flags & QPaintEngine::DirtyHints){
+        _target->setRenderHints(_target->renderHints(), false);
+        _target->setRenderHints(state.renderHints(), true);
+    }
+    if(flags & QPaintEngine::DirtyCompositionMode){
+        _target->setCompositionMode(state.compositionMode());
+    }
+    if(flags & QPaintEngine::DirtyOpacity){
+        _target->setOpacity(state.opacity());
+    }
+}
+
+void PdfImageCapEngine::drawPath(const QPainterPath &path){
+    _target->drawPath(path);
+}
+
+void PdfImageCapEngine::drawPolygon(const QPointF *points, int pointCount, PolygonDrawMode mode){
+    if(mode == QPaintEngine::PolylineMode){
+        _target->drawPolyline(points, pointCount);
+    }else{
+        _target->drawPolygon(points, pointCount, mode == QPaintEngine::WindingMode ? Qt::WindingFill : Qt::OddEvenFill);
+    }
+}
+
+void PdfImageCapEngine::drawRects(const QRectF *rects, int rectCount){
+    _target->drawRects(rects, rectCount);
+}
+
+void PdfImageCapEngine::drawLines(const QLineF *lines, int lineCount){
+    _target->drawLines(lines, lineCount);
+}
+
+void PdfImageCapEngine::drawEllipse(const QRectF &rect){
+    _target->drawEllipse(rect);
+}
+
+void PdfImageCapEngine::drawPoints(const QPointF *points, int pointCount){
+    _target->drawPoints(points, pointCount);
+}
+
+void PdfImageCapEngine::drawTextItem(const QPointF &p, const QTextItem &textItem){
+    _target->drawTextItem(p, textItem);
+}
+
+void PdfImageCapEngine::drawTiledPixmap(const QRectF &r, const QPixmap &pixmap, const QPointF &s){
+    // not capped, see the class comment
+    _target->drawTiledPixmap(r, pixmap, s);
+}
+
+void PdfImageCapEngine::drawPixmap(const QRectF &r, const QPixmap &pm, const QRectF &sr){
+    drawCapped(r, pm.toImage(), pm.cacheKey(), sr, Qt::AutoColor);
+}
+
+void PdfImageCapEngine::drawImage(const QRectF &r, const QImage &image, const QRectF &sr, Qt::ImageConversionFlags flags){
+    drawCapped(r, image, image.cacheKey(), sr, flags);
+}
+
+void PdfImageCapEngine::drawCapped(const QRectF &r, const QImage &image, qint64 cacheKey, const QRectF &sr, Qt::ImageConversionFlags flags){
+    // the size on paper, in inches, of what is drawn
+    QRectF onPaper = _transform.mapRect(r);
+    qreal widthInch = onPaper.width() / _targetDpi;
+    qreal heightInch = onPaper.height() / _targetDpi;
+    if(widthInch <= 0 || heightInch <= 0 || (sr.width() <= widthInch * _maxDpi && sr.height() <= heightInch * _maxDpi)){
+        _target->drawImage(r, image, sr, flags);
+        return;
+    }
+    QSize cappedSize(qMax(1, qCeil(qMin(sr.width(), widthInch * _maxDpi))), qMax(1, qCeil(qMin(sr.height(), heightInch * _maxDpi))));
+    QRect source = sr.toAlignedRect() & image.rect();
+    QString key = QString("%1:%2,%3,%4,%5:%6x%7").arg(cacheKey).arg(source.x()).arg(source.y()).arg(source.width()).arg(source.height())
+            .arg(cappedSize.width()).arg(cappedSize.height());
+    if(!_scaled.contains(key)){
+        _scaled.insert(key, image.copy(source).scaled(cappedSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+    }
+    const QImage &capped = _scaled[key];
+    _target->drawImage(r, capped, QRectF(capped.rect()), flags);
+}
+
+PdfImageCapDevice::PdfImageCapDevice(QPainter *target, QPaintDevice *targetDevice, qreal targetDpi, qreal maxDpi) :
+    _targetDevice(targetDevice),
+    _engine(new PdfImageCapEngine(target, targetDpi, maxDpi))
+{
+}
+
+PdfImageCapDevice::~PdfImageCapDevice(){
+    delete _engine;
+}
+
+QPaintEngine* PdfImageCapDevice::paintEngine() const{
+    return _engine;
+}
+
+int PdfImageCapDevice::metric(PaintDeviceMetric metric) const{
+    // the page lays itself out for the PDF, not for this device
+    switch (metric) {
+    case PdmWidth:
+        return _targetDevice->width();
+    case PdmHeight:
+        return _targetDevice->height();
+    case PdmWidthMM:
+        return _targetDevice->widthMM();
+    case PdmHeightMM:
+        return _targetDevice->heightMM();
+    case PdmNumColors:
+        return _targetDevice->colorCount();
+    case PdmDepth:
+        return _targetDevice->depth();
+    case PdmDpiX:
+        return _targetDevice->logicalDpiX();
+    case PdmDpiY:
+        return _targetDevice->logicalDpiY();
+    case PdmPhysicalDpiX:
+        return _targetDevice->physicalDpiX();
+    case PdmPhysicalDpiY:
+        return _targetDevice->physicalDpiY();
+    default:
+        return QPaintDevice::metric(metric);
+    }
+}
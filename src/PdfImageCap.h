@@ -0,0 +1,85 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef PDFIMAGECAP_H
+#define PDFIMAGECAP_H
+
+#include <QHash>
+#include <QImage>
+#include <QPaintDevice>
+#include <QPaintEngine>
+#include <QPainter>
+#include <QTransform>
+
+/**
+ * Forwards everything painted on it to a painter on a PDF, except that images and pixmaps drawn
+ * finer than maxDpi are scaled down to maxDpi first. Photos in a page are usually far finer than
+ * the paper needs, and the PDF engine embeds them as they come. Tiled pixmaps (repeated CSS
+ * backgrounds) are forwarded as they are: a tile is embedded once whatever the area it covers.
+ * Whatever transform the target painter has when painting begins stays under the ones painted here.
+ */
+class PdfImageCapEngine : public QPaintEngine
+{
+public:
+    PdfImageCapEngine(QPainter *target, qreal targetDpi, qreal maxDpi);
+    bool begin(QPaintDevice *device);
+    bool end();
+    Type type() const { return QPaintEngine::User; }
+    void updateState(const QPaintEngineState &state);
+    void drawPath(const QPainterPath &path);
+    void drawPolygon(const QPointF *points, int pointCount, PolygonDrawMode mode);
+    void drawRects(const QRectF *rects, int rectCount);
+    void drawLines(const QLineF *lines, int lineCount);
+    void drawEllipse(const QRectF &rect);
+    void drawPoints(const QPointF *points, int pointCount);
+    void drawTextItem(const QPointF &p, const QTextItem &textItem);
+    void drawTiledPixmap(const QRectF &r, const QPixmap &pixmap, const QPointF &s);
+    void drawPixmap(const QRectF &r, const QPixmap &pm, const QRectF &sr);
+    void drawImage(const QRectF &r, const QImage &image, const QRectF &sr, Qt::ImageConversionFlags flags = Qt::AutoColor);
+
+private:
+    void drawCapped(const QRectF &r, const QImage &image, qint64 cacheKey, const QRectF &sr, Qt::ImageConversionFlags flags);
+
+    QPainter *_target;
+    qreal _targetDpi;
+    qreal _maxDpi;
+    /**
+     * the target's own transform at begin, and the one painted with on top of it
+     */
+    QTransform _baseTransform;
+    QTransform _transform;
+    // the same picture drawn again is scaled once, so the PDF engine still embeds it once
+    QHash<QString, QImage> _scaled;
+};
+
+class PdfImageCapDevice : public QPaintDevice
+{
+public:
+    /**
+     * target paints on targetDevice, a PDF of targetDpi
+     */
+    PdfImageCapDevice(QPainter *target, QPaintDevice *targetDevice, qreal targetDpi, qreal maxDpi);
+    ~PdfImageCapDevice();
+    QPaintEngine *paintEngine() const;
+
+protected:
+    int metric(PaintDeviceMetric metric) const;
+
+private:
+    QPaintDevice *_targetDevice;
+    PdfImageCapEngine *_engine;
+};
+
+#endif // PDFIMAGECAP_H
@@ -0,0 +1,192 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QVector>
+#include <QtEndian>
+#include <zlib.h>
+#include "PngParallelEncoder.h"
+#include "PngStreamEncoder.h"
+
+static QThreadPool* pngPool = NULL;
+
+namespace {
+struct DeflateBlock
+{
+    int firstRow;
+    int lastRow;
+    bool last;
+    QByteArray data;
+    uLong adler;
+    uLong rawSize;
+};
+
+/**
+ * the filtered bytes of rows [from, to), the filter of a row only depends on the row above
+ * so any range can be filtered on its own
+ */
+void filterRows(const QImage &img, int from, int to, uchar *out){
+    int width = img.width();
+    int rowBytes = 1 + width * 4;
+    QByteArray raw(width * 4, 0);
+    QByteArray prev(width * 4, 0);
+    QByteArray scratch(rowBytes, 0);
+    if(from > 0){
+        PngStreamEncoder::toRgba(img.constScanLine(from - 1), width, reinterpret_cast<uchar*>(prev.data()));
+    }
+    for (int y = from; y < to; ++y) {
+        PngStreamEncoder::toRgba(img.constScanLine(y), width, reinterpret_cast<uchar*>(raw.data()));
+        PngStreamEncoder::filterRow(reinterpret_cast<const uchar*>(raw.constData()), reinterpret_cast<const uchar*>(prev.constData()),
+                                    width, out + size_t(y - from) * rowBytes, reinterpret_cast<uchar*>(scratch.data()));
+        raw.swap(prev);
+    }
+}
+
+void deflateBlock(const QImage &img, int compressionLevel, DeflateBlock *block){
+    int rowBytes = 1 + img.width() * 4;
+    // the rows before the block are filtered again to serve as its dictionary
+    int dictRows = qMin(block->firstRow, (int(PngParallelEncoder::WindowBytes) + rowBytes - 1) / rowBytes);
+    int rows = block->lastRow - block->firstRow;
+    QByteArray filtered;
+    filtered.resize((dictRows + rows) * rowBytes);
+    uchar *data = reinterpret_cast<uchar*>(filtered.data());
+    filterRows(img, block->firstRow - dictRows, block->lastRow, data);
+    uchar *input = data + dictRows * rowBytes;
+    block->rawSize = uLong(rows) * rowBytes;
+    block->adler = adler32(adler32(0L, Z_NULL, 0), input, block->rawSize);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(z_stream));
+    // raw deflate, the zlib header and adler32 are written once for the whole image
+    deflateInit2(&stream, compressionLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    if(dictRows > 0){
+        uInt dictSize = qMin<uInt>(PngParallelEncoder::WindowBytes, dictRows * rowBytes);
+        deflateSetDictionary(&stream, input - dictSize, dictSize);
+    }
+    block->data.resize(int(deflateBound(&stream, block->rawSize)) + 16);
+    stream.next_in = input;
+    stream.avail_in = block->rawSize;
+    stream.next_out = reinterpret_cast<Bytef*>(block->data.data());
+    stream.avail_out = block->data.size();
+    // a sync flush ends every block but the last on a byte boundary, without marking it final
+    int flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+    while (true) {
+        int ret = deflate(&stream, flush);
+        if(block->last ? ret == Z_STREAM_END : (stream.avail_in == 0 && stream.avail_out > 0)){
+            break;
+        }
+        int used = block->data.size() - stream.avail_out;
+        block->data.resize(block->data.size() * 2);
+        stream.next_out = reinterpret_cast<Bytef*>(block->data.data()) + used;
+        stream.avail_out = block->data.size() - used;
+    }
+    block->data.resize(block->data.size() - stream.avail_out);
+    deflateEnd(&stream);
+}
+
+class DeflateTask : public QRunnable
+{
+public:
+    DeflateTask(const QImage *img, int compressionLevel, DeflateBlock *block, QSemaphore *done) :
+        _img(img), _compressionLevel(compressionLevel), _block(block), _done(done) {}
+    void run(){
+        deflateBlock(*_img, _compressionLevel, _block);
+        _done->release();
+    }
+private:
+    const QImage *_img;
+    int _compressionLevel;
+    DeflateBlock *_block;
+    QSemaphore *_done;
+};
+}
+
+QThreadPool* PngParallelEncoder::pool(){
+    if(NULL == pngPool){
+        pngPool = new QThreadPool();
+        pngPool->setMaxThreadCount(QThread::idealThreadCount());
+    }
+    return pngPool;
+}
+
+void PngParallelEncoder::setThreadCount(int threads){
+    pool()->setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+}
+
+int PngParallelEncoder::threadCount(){
+    return pool()->maxThreadCount();
+}
+
+QByteArray PngParallelEncoder::encode(const QImage &img, int compressionLevel){
+    if(img.isNull()){
+        return QByteArray();
+    }
+    compressionLevel = qBound(-1, compressionLevel, 9);
+    QImage argb = img.format() == QImage::Format_ARGB32 ? img : img.convertToFormat(QImage::Format_ARGB32);
+    int rowBytes = 1 + argb.width() * 4;
+    int rowsPerBlock = qMax(1, int(BlockBytes) / rowBytes);
+    int blockCount = (argb.height() + rowsPerBlock - 1) / rowsPerBlock;
+    QVector<DeflateBlock> blocks(blockCount);
+    for (int i = 0; i < blockCount; ++i) {
+        blocks[i].firstRow = i * rowsPerBlock;
+        blocks[i].lastRow = qMin(argb.height(), (i + 1) * rowsPerBlock);
+        blocks[i].last = i == blockCount - 1;
+    }
+    if(threadCount() <= 1 || blockCount == 1){
+        for (int i = 0; i < blockCount; ++i) {
+            deflateBlock(argb, compressionLevel, &blocks[i]);
+        }
+    }else{
+        QSemaphore done;
+        for (int i = 0; i < blockCount; ++i) {
+            pool()->start(new DeflateTask(&argb, compressionLevel, &blocks[i], &done));
+        }
+        done.acquire(blockCount);
+    }
+
+    // zlib header: deflate with a 32K window, FLEVEL from the compression level, FCHECK so it divides by 31
+    int flevel = compressionLevel == 0 || compressionLevel == 1 ? 0 : compressionLevel < 6 && compressionLevel > 0 ? 1 : compressionLevel <= 6 ? 2 : 3;
+    uchar cmf = 0x78;
+    uchar flg = flevel << 6;
+    if((cmf * 256 + flg) % 31 != 0){
+        flg += 31 - (cmf * 256 + flg) % 31;
+    }
+    int zlibSize = 2 + 4;
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (int i = 0; i < blockCount; ++i) {
+        zlibSize += blocks.at(i).data.size();
+        adler = adler32_combine(adler, blocks.at(i).adler, blocks.at(i).rawSize);
+    }
+    QByteArray zlib;
+    zlib.reserve(zlibSize);
+    zlib.append(char(cmf)).append(char(flg));
+    for (int i = 0; i < blockCount; ++i) {
+        zlib.append(blocks.at(i).data);
+        blocks[i].data.clear();
+    }
+    uchar adlerBytes[4];
+    qToBigEndian<quint32>(quint32(adler), adlerBytes);
+    zlib.append(reinterpret_cast<const char*>(adlerBytes), 4);
+
+    QByteArray out = PngStreamEncoder::header(argb.width(), argb.height());
+    out.reserve(out.size() + zlib.size() + (zlib.size() / PngStreamEncoder::IdatSize + 2) * 12);
+    for (int offset = 0; offset < zlib.size(); offset += PngStreamEncoder::IdatSize) {
+        out.append(PngStreamEncoder::chunk("IDAT", zlib.constData() + offset, qMin<int>(PngStreamEncoder::IdatSize, zlib.size() - offset)));
+    }
+    out.append(PngStreamEncoder::chunk("IEND", 0, 0));
+    return out;
+}
@@ -0,0 +1,46 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef PNGPARALLELENCODER_H
+#define PNGPARALLELENCODER_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QThreadPool>
+
+/**
+ * pigz style PNG encoding: the filtered scanlines are cut into blocks that are deflated
+ * independently on a thread pool, each primed with the 32KB before it, then joined into one
+ * zlib stream. The output is an ordinary PNG.
+ */
+class PngParallelEncoder
+{
+public:
+    enum { BlockBytes = 256 * 1024, WindowBytes = 32 * 1024 };
+    /**
+     * compressionLevel is the zlib level, 0-9 or -1 for the zlib default
+     */
+    static QByteArray encode(const QImage &img, int compressionLevel = -1);
+    /**
+     * threads <= 0 means one per core, 1 encodes on the calling thread only
+     */
+    static void setThreadCount(int threads);
+    static int threadCount();
+
+private:
+    static QThreadPool* pool();
+};
+
+#endif // PNGPARALLELENCODER_H
@@ -0,0 +1,202 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QtEndian>
+#include "PngStreamEncoder.h"
+
+PngStreamEncoder::PngStreamEncoder(const Sink &sink, int compressionLevel) :
+    _sink(sink),
+    _compressionLevel(qBound(-1,compressionLevel,9)),
+    _streamOpen(false),
+    _failed(false),
+    _width(0),
+    _height(0),
+    _rowsWritten(0),
+    _bytesOut(0)
+{
+    memset(&_stream, 0, sizeof(z_stream));
+}
+
+PngStreamEncoder::~PngStreamEncoder(){
+    if(_streamOpen){
+        deflateEnd(&_stream);
+    }
+}
+
+bool PngStreamEncoder::begin(int width, int height){
+    if(width <= 0 || height <= 0 || deflateInit(&_stream, _compressionLevel) != Z_OK){
+        _failed = true;
+        return false;
+    }
+    _streamOpen = true;
+    _width = width;
+    _height = height;
+    _raw.resize(width * 4);
+    _prevRaw.fill(0, width * 4);
+    _filtered.resize(1 + width * 4);
+    _scratch.resize(1 + width * 4);
+    _idat.resize(IdatSize);
+    _stream.next_out = reinterpret_cast<Bytef*>(_idat.data());
+    _stream.avail_out = IdatSize;
+    QByteArray out = header(width, height);
+    _bytesOut += out.size();
+    if(!_sink(out)){
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+QByteArray PngStreamEncoder::header(int width, int height){
+    uchar ihdr[13];
+    qToBigEndian<quint32>(width, ihdr);
+    qToBigEndian<quint32>(height, ihdr + 4);
+    ihdr[8] = 8;  // bit depth
+    ihdr[9] = 6;  // RGBA
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // no interlace
+    return QByteArray("\x89PNG\r\n\x1a\n", 8) + chunk("IHDR", reinterpret_cast<const char*>(ihdr), 13);
+}
+
+void PngStreamEncoder::toRgba(const uchar *argbLine, int width, uchar *raw){
+    const QRgb *line = reinterpret_cast<const QRgb*>(argbLine);
+    for (int x = 0; x < width; ++x) {
+        QRgb pixel = line[x];
+        raw[x * 4] = qRed(pixel);
+        raw[x * 4 + 1] = qGreen(pixel);
+        raw[x * 4 + 2] = qBlue(pixel);
+        raw[x * 4 + 3] = qAlpha(pixel);
+    }
+}
+
+void PngStreamEncoder::filterRow(const uchar *raw, const uchar *prev, int width, uchar *out, uchar *scratch){
+    // Sub or Up, whichever leaves the smaller residuals, the usual heuristic of libpng
+    out[0] = 1;
+    scratch[0] = 2;
+    quint64 subCost = 0;
+    quint64 upCost = 0;
+    int size = width * 4;
+    for (int i = 0; i < size; ++i) {
+        uchar s = raw[i] - (i >= 4 ? raw[i - 4] : 0);
+        uchar u = raw[i] - prev[i];
+        out[i + 1] = s;
+        scratch[i + 1] = u;
+        subCost += s < 128 ? s : 256 - s;
+        upCost += u < 128 ? u : 256 - u;
+    }
+    if(upCost < subCost){
+        memcpy(out, scratch, size + 1);
+    }
+}
+
+void PngStreamEncoder::feedRow(const uchar *raw){
+    filterRow(raw, reinterpret_cast<const uchar*>(_prevRaw.constData()), _width,
+              reinterpret_cast<uchar*>(_filtered.data()), reinterpret_cast<uchar*>(_scratch.data()));
+    _stream.next_in = reinterpret_cast<Bytef*>(_filtered.data());
+    _stream.avail_in = _filtered.size();
+}
+
+bool PngStreamEncoder::writeRows(const QImage &rows, int rowCount){
+    if(_failed || !_streamOpen){
+        return false;
+    }
+    QImage argb = rows.format() == QImage::Format_ARGB32 ? rows : rows.convertToFormat(QImage::Format_ARGB32);
+    rowCount = qMin(rowCount, qMin(argb.height(), _height - _rowsWritten));
+    int width = qMin(_width, argb.width());
+    for (int y = 0; y < rowCount; ++y) {
+        uchar *raw = reinterpret_cast<uchar*>(_raw.data());
+        toRgba(argb.constScanLine(y), width, raw);
+        feedRow(raw);
+        if(!deflateInput(Z_NO_FLUSH)){
+            return false;
+        }
+        _prevRaw.swap(_raw);
+        _rowsWritten++;
+    }
+    return true;
+}
+
+bool PngStreamEncoder::deflateInput(int flush){
+    while (true) {
+        int ret = deflate(&_stream, flush);
+        if(ret == Z_STREAM_ERROR){
+            _failed = true;
+            return false;
+        }
+        if(_stream.avail_out == 0){
+            if(!emitChunk("IDAT", _idat.constData(), IdatSize)){
+                return false;
+            }
+            _stream.next_out = reinterpret_cast<Bytef*>(_idat.data());
+            _stream.avail_out = IdatSize;
+            continue;
+        }
+        if(flush == Z_FINISH ? ret == Z_STREAM_END : _stream.avail_in == 0){
+            return true;
+        }
+    }
+}
+
+bool PngStreamEncoder::finish(){
+    if(_failed || !_streamOpen){
+        return false;
+    }
+    // rows the caller never wrote are left transparent
+    _raw.fill(0);
+    while (_rowsWritten < _height) {
+        feedRow(reinterpret_cast<const uchar*>(_raw.constData()));
+        if(!deflateInput(Z_NO_FLUSH)){
+            return false;
+        }
+        _prevRaw.fill(0);
+        _rowsWritten++;
+    }
+    if(!deflateInput(Z_FINISH)){
+        return false;
+    }
+    int pending = IdatSize - _stream.avail_out;
+    if(pending > 0 && !emitChunk("IDAT", _idat.constData(), pending)){
+        return false;
+    }
+    deflateEnd(&_stream);
+    _streamOpen = false;
+    return emitChunk("IEND", 0, 0);
+}
+
+bool PngStreamEncoder::emitChunk(const char *type, const char *data, int size){
+    QByteArray out = chunk(type, data, size);
+    _bytesOut += out.size();
+    if(!_sink(out)){
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+QByteArray PngStreamEncoder::chunk(const char *type, const char *data, int size){
+    QByteArray out;
+    out.resize(12 + size);
+    uchar *p = reinterpret_cast<uchar*>(out.data());
+    qToBigEndian<quint32>(size, p);
+    memcpy(p + 4, type, 4);
+    if(size > 0){
+        memcpy(p + 8, data, size);
+    }
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, p + 4, 4 + size);
+    qToBigEndian<quint32>(quint32(crc), p + 8 + size);
+    return out;
+}
@@ -0,0 +1,79 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef PNGSTREAMENCODER_H
+#define PNGSTREAMENCODER_H
+
+#include <functional>
+#include <QByteArray>
+#include <QImage>
+#include <zlib.h>
+
+/**
+ * Writes a PNG a band of rows at a time, so a page never has to exist as one image nor as one
+ * encoded buffer. Every complete piece of PNG output (signature and IHDR, each full IDAT, the
+ * trailer) is handed to the sink as soon as it exists; the sink returns false to give up.
+ */
+class PngStreamEncoder
+{
+public:
+    typedef std::function<bool(const QByteArray &chunk)> Sink;
+    enum { IdatSize = 64 * 1024 };
+    /**
+     * compressionLevel is the zlib level, 0-9 or -1 for the zlib default
+     */
+    explicit PngStreamEncoder(const Sink &sink, int compressionLevel = -1);
+    ~PngStreamEncoder();
+    bool begin(int width, int height);
+    /**
+     * the first rowCount rows of rows, which is width wide and ARGB32
+     */
+    bool writeRows(const QImage &rows, int rowCount);
+    bool finish();
+    qint64 bytesOut() const { return _bytesOut; }
+
+    /**
+     * building blocks shared with PngParallelEncoder
+     */
+    static QByteArray header(int width, int height);
+    static QByteArray chunk(const char *type, const char *data, int size);
+    static void toRgba(const uchar *argbLine, int width, uchar *raw);
+    /**
+     * writes the filter type byte and the filtered row, 1 + width * 4 bytes, into out
+     */
+    static void filterRow(const uchar *raw, const uchar *prev, int width, uchar *out, uchar *scratch);
+
+private:
+    bool emitChunk(const char *type, const char *data, int size);
+    bool deflateInput(int flush);
+    void feedRow(const uchar *raw);
+
+    Sink _sink;
+    int _compressionLevel;
+    z_stream _stream;
+    bool _streamOpen;
+    bool _failed;
+    int _width;
+    int _height;
+    int _rowsWritten;
+    qint64 _bytesOut;
+    QByteArray _raw;
+    QByteArray _prevRaw;
+    QByteArray _filtered;
+    QByteArray _scratch;
+    QByteArray _idat;
+};
+
+#endif // PNGSTREAMENCODER_H
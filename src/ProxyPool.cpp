@@ -0,0 +1,248 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QFile>
+#include <QTextStream>
+#include <QRegularExpression>
+#include <QRegularExpressionMatch>
+#include "ProxyPool.h"
+
+#define SEIMI_PROXY_MAX_EJECT_MS 300000
+#define SEIMI_PROXY_MAX_STICKY_HOSTS 10000
+
+ProxyPool::ProxyPool(QObject *parent) : QObject(parent),
+    _strategy(RoundRobin),
+    _next(0),
+    _maxFailures(3),
+    _ejectTimeMs(30000),
+    _connectTimeoutMs(5000)
+{
+    _clock.start();
+}
+
+bool ProxyPool::parseProxy(const QString &proxyStr, QNetworkProxy &proxy){
+    static const QRegularExpression reProxy("(?<protocol>http|https|socket)://(?:(?<user>\\w*):(?<password>\\w*)@)?(?<host>[\\w.]+)(:(?<port>\\d+))?");
+    QRegularExpressionMatch matchProxy = reProxy.match(proxyStr);
+    if(!matchProxy.hasMatch()){
+        return false;
+    }
+    if(matchProxy.captured("protocol") == "socket"){
+        proxy.setType(QNetworkProxy::Socks5Proxy);
+    }else{
+        proxy.setType(QNetworkProxy::HttpProxy);
+    }
+    int port = matchProxy.captured("port").toInt();
+    proxy.setHostName(matchProxy.captured("host"));
+    proxy.setPort(port==0?80:port);
+    proxy.setUser(matchProxy.captured("user"));
+    proxy.setPassword(matchProxy.captured("password"));
+    return true;
+}
+
+bool ProxyPool::load(const QString &path){
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly|QIODevice::Text)){
+        qWarning("[seimi] proxy pool file[%s] can not be read",path.toUtf8().constData());
+        return false;
+    }
+    QTextStream in(&file);
+    while(!in.atEnd()){
+        QString line = in.readLine().trimmed();
+        if(line.isEmpty()||line.startsWith('#')){
+            continue;
+        }
+        QNetworkProxy proxy;
+        if(parseProxy(line,proxy)){
+            addProxy(proxy);
+        }else{
+            qWarning("[seimi] proxy pattern error, proxy = %s",line.toUtf8().constData());
+        }
+    }
+    qInfo("[seimi] proxy pool loaded %d proxies from %s",_entries.size(),path.toUtf8().constData());
+    return !_entries.isEmpty();
+}
+
+void ProxyPool::addProxy(const QNetworkProxy &proxy){
+    ProxyEntry entry;
+    entry.proxy = proxy;
+    entry.name = QString("%1:%2").arg(proxy.hostName()).arg(proxy.port());
+    entry.successCount = 0;
+    entry.failureCount = 0;
+    entry.successRate = 1.0;
+    entry.latency = 0;
+    entry.consecutiveFailures = 0;
+    entry.ejectCount = 0;
+    entry.ejectedUntil = 0;
+    _entries.append(entry);
+}
+
+bool ProxyPool::isEmpty() const{
+    return _entries.isEmpty();
+}
+
+int ProxyPool::size() const{
+    return _entries.size();
+}
+
+void ProxyPool::setStrategy(Strategy strategy){
+    _strategy = strategy;
+    _stickyHosts.clear();
+}
+
+bool ProxyPool::setStrategy(const QString &strategyName){
+    if(strategyName == "roundrobin"){
+        setStrategy(RoundRobin);
+    }else if(strategyName == "latency"){
+        setStrategy(LeastLatency);
+    }else if(strategyName == "sticky"){
+        setStrategy(StickyHost);
+    }else{
+        return false;
+    }
+    return true;
+}
+
+ProxyPool::Strategy ProxyPool::strategy() const{
+    return _strategy;
+}
+
+void ProxyPool::setEjectPolicy(int maxFailures, int ejectTimeMs){
+    if(maxFailures > 0){
+        _maxFailures = maxFailures;
+    }
+    if(ejectTimeMs > 0){
+        _ejectTimeMs = ejectTimeMs;
+    }
+}
+
+void ProxyPool::setConnectTimeout(int connectTimeoutMs){
+    if(connectTimeoutMs > 0){
+        _connectTimeoutMs = connectTimeoutMs;
+    }
+}
+
+int ProxyPool::connectTimeout() const{
+    return _connectTimeoutMs;
+}
+
+bool ProxyPool::isAvailable(const ProxyEntry &entry, qint64 now) const{
+    return entry.ejectedUntil <= now;
+}
+
+int ProxyPool::nextRoundRobin(qint64 now){
+    for (int i = 0; i < _entries.size(); ++i) {
+        int id = _next;
+        _next = (_next + 1) % _entries.size();
+        if(isAvailable(_entries.at(id),now)){
+            return id;
+        }
+    }
+    return -1;
+}
+
+int ProxyPool::leastLatency(qint64 now) const{
+    int best = -1;
+    double bestScore = 0;
+    for (int i = 0; i < _entries.size(); ++i) {
+        const ProxyEntry &entry = _entries.at(i);
+        if(!isAvailable(entry,now)){
+            continue;
+        }
+        // untried proxies score 0 so that every proxy gets measured at least once
+        double score = entry.latency / qMax(entry.successRate,0.05);
+        if(best < 0 || score < bestScore){
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+int ProxyPool::soonestBack() const{
+    int best = -1;
+    for (int i = 0; i < _entries.size(); ++i) {
+        if(best < 0 || _entries.at(i).ejectedUntil < _entries.at(best).ejectedUntil){
+            best = i;
+        }
+    }
+    return best;
+}
+
+int ProxyPool::select(const QString &host){
+    if(_entries.isEmpty()){
+        return -1;
+    }
+    qint64 now = _clock.elapsed();
+    int id = -1;
+    switch (_strategy) {
+    case StickyHost:
+        id = _stickyHosts.value(host,-1);
+        if(id < 0 || !isAvailable(_entries.at(id),now)){
+            id = nextRoundRobin(now);
+            if(id >= 0){
+                if(_stickyHosts.size() >= SEIMI_PROXY_MAX_STICKY_HOSTS){
+                    _stickyHosts.clear();
+                }
+                _stickyHosts.insert(host,id);
+            }
+        }
+        break;
+    case LeastLatency:
+        id = leastLatency(now);
+        break;
+    default:
+        id = nextRoundRobin(now);
+        break;
+    }
+    if(id < 0){
+        // every proxy is ejected, better to try the one coming back first than to fail outright
+        id = soonestBack();
+    }
+    return id;
+}
+
+QNetworkProxy ProxyPool::proxyAt(int id) const{
+    return _entries.at(id).proxy;
+}
+
+QString ProxyPool::nameAt(int id) const{
+    return _entries.at(id).name;
+}
+
+void ProxyPool::reportResult(int id, bool ok, qint64 latencyMs){
+    if(id < 0 || id >= _entries.size()){
+        return;
+    }
+    ProxyEntry &entry = _entries[id];
+    entry.successRate = entry.successRate * 0.8 + (ok ? 0.2 : 0);
+    if(ok){
+        entry.successCount++;
+        entry.consecutiveFailures = 0;
+        entry.ejectCount = 0;
+        entry.latency = entry.latency <= 0 ? latencyMs : entry.latency * 0.8 + latencyMs * 0.2;
+        return;
+    }
+    entry.failureCount++;
+    entry.consecutiveFailures++;
+    if(entry.consecutiveFailures < _maxFailures){
+        return;
+    }
+    qint64 ejectMs = qMin<qint64>(qint64(_ejectTimeMs) << qMin(entry.ejectCount,4),SEIMI_PROXY_MAX_EJECT_MS);
+    entry.ejectCount++;
+    entry.ejectedUntil = _clock.elapsed() + ejectMs;
+    // once it is back a single further failure ejects it again
+    entry.consecutiveFailures = _maxFailures - 1;
+    qWarning("[seimi] proxy[%s] ejected for %lldms, success rate:%3.2f%%",entry.name.toUtf8().constData(),ejectMs,entry.successRate*100.0);
+}
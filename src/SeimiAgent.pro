@@ -10,7 +10,17 @@ SOURCES += main.cpp \
     NetworkAccessManager.cpp \
     cookiejar.cpp \
     SeimiAgent.cpp \
-    crashdump.cpp
+    crashdump.cpp \
+    ProxyPool.cpp \
+    TimerWheel.cpp \
+    SeimiMetrics.cpp \
+    SeimiFlightRecorder.cpp \
+    SeimiTracer.cpp \
+    SeimiLoopMonitor.cpp \
+    SeimiLog.cpp \
+    PngStreamEncoder.cpp \
+    PngParallelEncoder.cpp \
+    PdfImageCap.cpp
 
 HEADERS += \
     SeimiWebPage.h \
@@ -18,6 +28,20 @@ HEADERS += \
     NetworkAccessManager.h \
     cookiejar.h \
     SeimiAgent.h \
-    crashdump.h
+    crashdump.h \
+    ProxyPool.h \
+    TimerWheel.h \
+    SeimiMetrics.h \
+    SeimiFlightRecorder.h \
+    SeimiTracer.h \
+    SeimiLoopMonitor.h \
+    SeimiLog.h \
+    PngStreamEncoder.h \
+    PngParallelEncoder.h \
+    PdfImageCap.h
 
 include(pillowcore/pillowcore.pri)
+
+# the PNG encoders call zlib directly, pillowcore only ships its headers
+isEmpty(PILLOW_ZLIB_LIBS): PILLOW_ZLIB_LIBS = -lz
+LIBS += $$PILLOW_ZLIB_LIBS
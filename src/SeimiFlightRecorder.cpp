@@ -0,0 +1,125 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <algorithm>
+#include "SeimiFlightRecorder.h"
+#include "pillowcore/HttpConnection.h"
+
+static SeimiFlightRecorder* seimiFlightRecorderInstance = NULL;
+
+SeimiFlightRecorder::SeimiFlightRecorder():
+    _percentile(0),
+    _windowNext(0),
+    _sinceRefresh(0),
+    _thresholdMs(-1),
+    _tracesNext(0),
+    _capacity(0),
+    _recordedCount(0)
+{
+}
+
+SeimiFlightRecorder* SeimiFlightRecorder::instance(){
+    if(NULL == seimiFlightRecorderInstance){
+        seimiFlightRecorderInstance = new SeimiFlightRecorder();
+    }
+    return seimiFlightRecorderInstance;
+}
+
+void SeimiFlightRecorder::configure(double percentile, int capacity){
+    _percentile = qMin(percentile, 100.0);
+    _capacity = qMax(1, capacity);
+    _window.clear();
+    _window.reserve(WindowSize);
+    _windowNext = 0;
+    _sinceRefresh = 0;
+    _thresholdMs = -1;
+    _traces.clear();
+    _tracesNext = 0;
+}
+
+bool SeimiFlightRecorder::isEnabled(){
+    return _percentile > 0;
+}
+
+bool SeimiFlightRecorder::isSlow(qint64 totalMs){
+    if(!isEnabled()){
+        return false;
+    }
+    if(_window.size() < WindowSize){
+        _window.append(totalMs);
+    }else{
+        _window[_windowNext] = totalMs;
+        _windowNext = (_windowNext + 1) % WindowSize;
+    }
+    if(++_sinceRefresh >= RefreshEvery || _thresholdMs < 0){
+        refreshThreshold();
+    }
+    // until the window is warm every render would look like the tail
+    return _thresholdMs >= 0 && totalMs > _thresholdMs;
+}
+
+void SeimiFlightRecorder::refreshThreshold(){
+    _sinceRefresh = 0;
+    if(_window.size() < MinSamples){
+        return;
+    }
+    QVector<qint64> sorted = _window;
+    int rank = qBound(0, int(sorted.size() * _percentile / 100.0), sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    _thresholdMs = sorted.at(rank);
+}
+
+void SeimiFlightRecorder::record(const QJsonObject &trace){
+    _recordedCount++;
+    if(_traces.size() < _capacity){
+        _traces.append(trace);
+        return;
+    }
+    _traces[_tracesNext] = trace;
+    _tracesNext = (_tracesNext + 1) % _capacity;
+}
+
+QByteArray SeimiFlightRecorder::dump(){
+    QJsonArray traces;
+    // _tracesNext is the oldest one once the ring is full
+    for (int i = _traces.size() - 1; i >= 0; --i) {
+        traces.append(_traces.at((_tracesNext + i) % _traces.size()));
+    }
+    QJsonObject out;
+    out.insert("percentile", _percentile);
+    out.insert("thresholdMs", _thresholdMs);
+    out.insert("samples", _window.size());
+    out.insert("recorded", _recordedCount);
+    out.insert("traces", traces);
+    return QJsonDocument(out).toJson(QJsonDocument::Indented);
+}
+
+SeimiFlightRecorderHandler::SeimiFlightRecorderHandler(QObject *parent):Pillow::HttpHandler(parent)
+{
+
+}
+
+bool SeimiFlightRecorderHandler::handleRequest(Pillow::HttpConnection *connection){
+    if(connection->requestPath() != "/debug/slow"){
+        return false;
+    }
+    Pillow::HttpHeaderCollection headers;
+    headers << Pillow::HttpHeader("Content-Type", "application/json;charset=utf-8");
+    headers << Pillow::HttpHeader("Cache-Control", "no-cache");
+    connection->writeResponse(200, headers, SeimiFlightRecorder::instance()->dump());
+    return true;
+}
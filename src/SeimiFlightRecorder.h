@@ -0,0 +1,75 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef SEIMIFLIGHTRECORDER_H
+#define SEIMIFLIGHTRECORDER_H
+
+#include <QVector>
+#include <QJsonObject>
+#include <QByteArray>
+#include "pillowcore/HttpHandler.h"
+
+/**
+ * Keeps the detailed traces of the slowest renders only. The total latency of the last
+ * WindowSize renders gives the threshold, any render above the configured percentile of it
+ * replaces the oldest trace of a fixed size ring.
+ * Lives in the GUI thread, not thread safe.
+ */
+class SeimiFlightRecorder
+{
+public:
+    enum { WindowSize = 1024, MinSamples = 100, RefreshEvery = 32 };
+
+    static SeimiFlightRecorder* instance();
+
+    /**
+     * percentile <= 0 turns the recorder off
+     */
+    void configure(double percentile, int capacity);
+    bool isEnabled();
+    /**
+     * feeds the latency window and tells whether this render belongs to the recorded tail
+     */
+    bool isSlow(qint64 totalMs);
+    void record(const QJsonObject &trace);
+    /**
+     * json of the recorded traces, newest first
+     */
+    QByteArray dump();
+
+private:
+    SeimiFlightRecorder();
+    void refreshThreshold();
+
+    double _percentile;
+    QVector<qint64> _window;
+    int _windowNext;
+    int _sinceRefresh;
+    qint64 _thresholdMs;
+    QVector<QJsonObject> _traces;
+    int _tracesNext;
+    int _capacity;
+    qint64 _recordedCount;
+};
+
+class SeimiFlightRecorderHandler : public Pillow::HttpHandler
+{
+    Q_OBJECT
+public:
+    SeimiFlightRecorderHandler(QObject* parent = 0);
+    bool handleRequest(Pillow::HttpConnection *connection);
+};
+
+#endif // SEIMIFLIGHTRECORDER_H
@@ -0,0 +1,364 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QAtomicPointer>
+#include <QDateTime>
+#include <QFile>
+#include <QThread>
+#include <stdio.h>
+#include "SeimiLog.h"
+#include "pillowcore/HttpConnection.h"
+
+QAtomicInt SeimiLog::_level(SeimiLog::Info);
+
+namespace
+{
+    struct LogNode
+    {
+        QAtomicPointer<LogNode> next;
+        qint64 msecs;
+        SeimiLog::Level level;
+        QByteArray fields;
+    };
+
+    /**
+     * Vyukov's intrusive MPSC queue: a push is one atomic exchange, pop belongs to the writer only
+     */
+    class LogQueue
+    {
+    public:
+        LogQueue() : _head(&_stub), _tail(&_stub) { _stub.next.store(0); }
+        void push(LogNode *node) {
+            node->next.store(0);
+            LogNode *prev = _head.fetchAndStoreOrdered(node);
+            prev->next.storeRelease(node);
+        }
+        // the returned node becomes the new stub, its content is valid until the next pop
+        LogNode* pop() {
+            LogNode *tail = _tail;
+            LogNode *next = tail->next.loadAcquire();
+            if (next == 0)
+                return 0;
+            _tail = next;
+            if (tail != &_stub)
+                delete tail;
+            return next;
+        }
+    private:
+        LogNode _stub;
+        QAtomicPointer<LogNode> _head;
+        LogNode *_tail;
+    };
+
+    class LogWriter : public QThread
+    {
+    public:
+        LogWriter() : stopping(0) {}
+        void run() {
+            while (!stopping.loadAcquire()) {
+                if (!drain())
+                    msleep(20);
+            }
+            drain();
+        }
+        bool drain();
+        void output(const QByteArray &batch) {
+            if (file.isOpen()) {
+                file.write(batch);
+                file.flush();
+            } else {
+                fwrite(batch.constData(), 1, batch.size(), stderr);
+                fflush(stderr);
+            }
+        }
+        QFile file;
+        LogQueue queue;
+        QAtomicInt stopping;
+    };
+
+    QAtomicPointer<LogWriter> writer;
+    /**
+     * threads between loading writer and pushing to its queue, stop waits for them before deleting it
+     */
+    QAtomicInt writing(0);
+    QtMessageHandler previousHandler = 0;
+    QAtomicInt progressEvery(10);
+    QAtomicInt progressCounter(0);
+}
+
+static void appendLine(QByteArray &out, qint64 msecs, SeimiLog::Level level, const QByteArray &fields){
+    out.append("time=").append(QDateTime::fromMSecsSinceEpoch(msecs).toString("yyyy-MM-dd'T'HH:mm:ss.zzz").toLatin1())
+       .append(" level=").append(SeimiLog::levelName(level))
+       .append(fields).append('\n');
+}
+
+bool LogWriter::drain(){
+    QByteArray batch;
+    LogNode *node;
+    while ((node = queue.pop()) != 0) {
+        appendLine(batch, node->msecs, node->level, node->fields);
+        node->fields = QByteArray();
+        if (batch.size() > 64 * 1024) {
+            output(batch);
+            batch.clear();
+        }
+    }
+    if (batch.isEmpty())
+        return false;
+    output(batch);
+    return true;
+}
+
+static void appendValue(QByteArray &fields, const QByteArray &value){
+    bool quote = value.isEmpty();
+    for (int i = 0; i < value.size() && !quote; ++i) {
+        char c = value.at(i);
+        quote = c == ' ' || c == '"' || c == '=' || uchar(c) < 0x20;
+    }
+    if (!quote) {
+        fields.append(value);
+        return;
+    }
+    fields.append('"');
+    for (int i = 0; i < value.size(); ++i) {
+        char c = value.at(i);
+        if (c == '"' || c == '\\')
+            fields.append('\\').append(c);
+        else if (c == '\n')
+            fields.append("\\n");
+        else if (uchar(c) < 0x20)
+            fields.append(' ');
+        else
+            fields.append(c);
+    }
+    fields.append('"');
+}
+
+static void messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message){
+    SeimiLog::Level level = SeimiLog::Info;
+    switch (type) {
+    case QtDebugMsg: level = SeimiLog::Debug; break;
+    case QtWarningMsg: level = SeimiLog::Warn; break;
+    case QtCriticalMsg:
+    case QtFatalMsg: level = SeimiLog::Error; break;
+    default: break;
+    }
+    if (type == QtFatalMsg) {
+        // we are about to abort, nothing queued would make it out
+        SeimiLog::stop();
+        if (previousHandler)
+            previousHandler(type, context, message);
+        return;
+    }
+    if (!SeimiLog::isEnabled(level))
+        return;
+    QByteArray fields(" msg=");
+    appendValue(fields, message.toUtf8());
+    SeimiLog::write(level, fields);
+}
+
+bool SeimiLog::start(const QString &logFile){
+    if (writer.loadAcquire())
+        return true;
+    LogWriter *started = new LogWriter();
+    if (!logFile.isEmpty()) {
+        started->file.setFileName(logFile);
+        if (!started->file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            fprintf(stderr, "[seimi] can not open log file[%s], log to stderr\n", logFile.toUtf8().constData());
+        }
+    }
+    started->start(QThread::LowPriority);
+    writer.storeRelease(started);
+    previousHandler = qInstallMessageHandler(messageHandler);
+    return true;
+}
+
+void SeimiLog::stop(){
+    LogWriter *stopped = writer.fetchAndStoreAcquire(0);
+    if (!stopped)
+        return;
+    qInstallMessageHandler(previousHandler);
+    // lines written from now on go straight to stderr, wait for the ones already on their way to the queue
+    while (writing.loadAcquire() > 0)
+        QThread::yieldCurrentThread();
+    stopped->stopping.storeRelease(1);
+    if (stopped == QThread::currentThread()) {
+        // a fatal message from the writer thread itself, it can be neither joined nor deleted
+        stopped->drain();
+        return;
+    }
+    stopped->wait();
+    stopped->drain();
+    delete stopped;
+}
+
+void SeimiLog::setLevel(Level level){
+    _level.store(int(level));
+}
+
+SeimiLog::Level SeimiLog::level(){
+    return Level(_level.load());
+}
+
+const char* SeimiLog::levelName(Level level){
+    static const char* const names[] = {"debug", "info", "warn", "error", "off"};
+    return names[level];
+}
+
+bool SeimiLog::parseLevel(const QString &name, Level *level){
+    for (int i = Debug; i <= Off; ++i) {
+        if (name.compare(QLatin1String(levelName(Level(i))), Qt::CaseInsensitive) == 0) {
+            *level = Level(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void SeimiLog::setProgressSampling(int every){
+    progressEvery.store(qMax(0, every));
+}
+
+bool SeimiLog::sampleProgress(){
+    int every = progressEvery.load();
+    if (every <= 0)
+        return false;
+    return progressCounter.fetchAndAddRelaxed(1) % every == 0;
+}
+
+void SeimiLog::write(Level level, const QByteArray &fields){
+    writing.ref();
+    LogWriter *current = writer.loadAcquire();
+    if (!current) {
+        writing.deref();
+        QByteArray line;
+        appendLine(line, QDateTime::currentMSecsSinceEpoch(), level, fields);
+        fwrite(line.constData(), 1, line.size(), stderr);
+        return;
+    }
+    LogNode *node = new LogNode;
+    node->msecs = QDateTime::currentMSecsSinceEpoch();
+    node->level = level;
+    node->fields = fields;
+    current->queue.push(node);
+    writing.deref();
+}
+
+SeimiLogLine::SeimiLogLine(SeimiLog::Level level, const char *event) : _level(level)
+{
+    _fields.reserve(128);
+    _fields.append(" event=").append(event);
+}
+
+SeimiLogLine::~SeimiLogLine(){
+    SeimiLog::write(_level, _fields);
+}
+
+SeimiLogLine& SeimiLogLine::kv(const char *key, const QString &value){
+    return kv(key, value.toUtf8());
+}
+
+SeimiLogLine& SeimiLogLine::kv(const char *key, const QByteArray &value){
+    _fields.append(' ').append(key).append('=');
+    appendValue(_fields, value);
+    return *this;
+}
+
+SeimiLogLine& SeimiLogLine::kv(const char *key, const char *value){
+    return kv(key, QByteArray::fromRawData(value, int(qstrlen(value))));
+}
+
+SeimiLogLine& SeimiLogLine::kv(const char *key, qint64 value){
+    _fields.append(' ').append(key).append('=').append(QByteArray::number(value));
+    return *this;
+}
+
+SeimiLogLine& SeimiLogLine::kv(const char *key, int value){
+    return kv(key, qint64(value));
+}
+
+SeimiLogLine& SeimiLogLine::kv(const char *key, double value){
+    _fields.append(' ').append(key).append('=').append(QByteArray::number(value, 'f', 3));
+    return *this;
+}
+
+SeimiAccessLogHandler::SeimiAccessLogHandler(QObject *parent):Pillow::HttpHandler(parent)
+{
+    _clock.start();
+}
+
+bool SeimiAccessLogHandler::handleRequest(Pillow::HttpConnection *connection){
+    if(!_startedAt.contains(connection)){
+        // connections are reused for many requests, hook them once
+        connect(connection,SIGNAL(requestCompleted(Pillow::HttpConnection*)),this,SLOT(requestCompleted(Pillow::HttpConnection*)));
+        connect(connection,SIGNAL(destroyed(QObject*)),this,SLOT(requestDestroyed(QObject*)));
+    }
+    _startedAt[connection] = _clock.elapsed();
+    return false;
+}
+
+void SeimiAccessLogHandler::requestCompleted(Pillow::HttpConnection *connection){
+    if(!SeimiLog::isEnabled(SeimiLog::Info)){
+        return;
+    }
+    qint64 elapsed = _clock.elapsed() - _startedAt.value(connection,_clock.elapsed());
+    SeimiLogLine(SeimiLog::Info,"access")
+            .kv("remote",connection->remoteAddress().toString())
+            .kv("method",connection->requestMethod())
+            .kv("uri",connection->requestUri())
+            .kv("status",connection->responseStatusCode())
+            .kv("bytes",connection->responseContentLength())
+            .kv("ms",elapsed);
+}
+
+void SeimiAccessLogHandler::requestDestroyed(QObject *connection){
+    _startedAt.remove(static_cast<Pillow::HttpConnection*>(connection));
+}
+
+SeimiLogLevelHandler::SeimiLogLevelHandler(QObject *parent):Pillow::HttpHandler(parent)
+{
+
+}
+
+bool SeimiLogLevelHandler::handleRequest(Pillow::HttpConnection *connection){
+    if(connection->requestPath() != "/debug/log"){
+        return false;
+    }
+    const QByteArray &method = connection->requestMethod();
+    bool change = method == "POST" || method == "PUT";
+    QString levelParam = connection->requestParamValue("level");
+    if(!change && (method != "GET" || !levelParam.isEmpty())){
+        // a GET must never change anything, crawlers and link previews follow them
+        Pillow::HttpHeaderCollection headers;
+        headers << Pillow::HttpHeader("Allow", "GET, POST, PUT");
+        connection->writeResponse(405, headers, "use POST or PUT to change the log level\n");
+        return true;
+    }
+    int statusCode = 200;
+    if(change){
+        SeimiLog::Level level;
+        if(SeimiLog::parseLevel(levelParam,&level)){
+            SeimiLog::setLevel(level);
+            seimiLog(SeimiLog::Warn,"log_level").kv("level",SeimiLog::levelName(level));
+        }else{
+            statusCode = 400;
+        }
+    }
+    Pillow::HttpHeaderCollection headers;
+    headers << Pillow::HttpHeader("Content-Type", "text/plain");
+    headers << Pillow::HttpHeader("Cache-Control", "no-cache");
+    connection->writeResponse(statusCode, headers, QByteArray("level=") + SeimiLog::levelName(SeimiLog::level()) + "\n");
+    return true;
+}
@@ -0,0 +1,110 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef SEIMILOG_H
+#define SEIMILOG_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QString>
+#include "pillowcore/HttpHandler.h"
+
+/**
+ * Asynchronous key=value logger. Producers format their line and push it on a lock-free
+ * MPSC queue, a writer thread batches the lines out to stderr or the log file. Qt messages
+ * (qInfo, qWarning...) are routed through it too once started. The level can be changed at
+ * runtime.
+ */
+class SeimiLog
+{
+public:
+    enum Level { Debug, Info, Warn, Error, Off };
+
+    static bool start(const QString &logFile);
+    static void stop();
+
+    static inline bool isEnabled(Level level) { return int(level) >= _level.load(); }
+    static void setLevel(Level level);
+    static Level level();
+    static const char* levelName(Level level);
+    static bool parseLevel(const QString &name, Level *level);
+
+    /**
+     * only one out of every progress ticks is logged, 0 turns progress logging off
+     */
+    static void setProgressSampling(int every);
+    static bool sampleProgress();
+
+    static void write(Level level, const QByteArray &fields);
+
+private:
+    static QAtomicInt _level;
+};
+
+/**
+ * Builds one line and queues it when it goes out of scope, use it through seimiLog.
+ */
+class SeimiLogLine
+{
+public:
+    SeimiLogLine(SeimiLog::Level level, const char *event);
+    ~SeimiLogLine();
+    SeimiLogLine& kv(const char *key, const QString &value);
+    SeimiLogLine& kv(const char *key, const QByteArray &value);
+    SeimiLogLine& kv(const char *key, const char *value);
+    SeimiLogLine& kv(const char *key, qint64 value);
+    SeimiLogLine& kv(const char *key, int value);
+    SeimiLogLine& kv(const char *key, double value);
+
+private:
+    SeimiLog::Level _level;
+    QByteArray _fields;
+};
+
+#define seimiLog(level, event) if (!SeimiLog::isEnabled(level)) {} else SeimiLogLine(level, event)
+
+/**
+ * Access log in key=value, replaces Pillow::HttpHandlerLog.
+ */
+class SeimiAccessLogHandler : public Pillow::HttpHandler
+{
+    Q_OBJECT
+public:
+    SeimiAccessLogHandler(QObject* parent = 0);
+    bool handleRequest(Pillow::HttpConnection *connection);
+
+private slots:
+    void requestCompleted(Pillow::HttpConnection *connection);
+    void requestDestroyed(QObject *connection);
+
+private:
+    QHash<Pillow::HttpConnection*, qint64> _startedAt;
+    QElapsedTimer _clock;
+};
+
+/**
+ * GET /debug/log shows the level, POST or PUT /debug/log with level=debug|info|warn|error|off changes it.
+ */
+class SeimiLogLevelHandler : public Pillow::HttpHandler
+{
+    Q_OBJECT
+public:
+    SeimiLogLevelHandler(QObject* parent = 0);
+    bool handleRequest(Pillow::HttpConnection *connection);
+};
+
+#endif // SEIMILOG_H
@@ -0,0 +1,140 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QMutexLocker>
+#include "SeimiLoopMonitor.h"
+#include "SeimiMetrics.h"
+
+static SeimiLoopMonitor* seimiLoopMonitorInstance = NULL;
+
+class SeimiLoopWatchdog : public QThread
+{
+public:
+    SeimiLoopWatchdog(SeimiLoopMonitor *monitor) : _stopping(0), _monitor(monitor) {}
+    void run(){
+        qint64 reportedAt = 0;
+        while(!_stopping.loadAcquire()){
+            msleep(SeimiLoopMonitor::BeatMs);
+            qint64 blocked = _monitor->sinceLastBeat();
+            if(blocked < _monitor->stallThreshold()){
+                reportedAt = 0;
+                continue;
+            }
+            // report once per threshold, a long stall shows up as a growing series
+            if(reportedAt > 0 && blocked - reportedAt < _monitor->stallThreshold()){
+                continue;
+            }
+            reportedAt = blocked;
+            const char *operation = NULL;
+            QString url;
+            _monitor->activity(&operation,&url);
+            qWarning("[seimi] event loop blocked for %lldms, running:%s ,TargetUrl:%s",blocked,operation == NULL ? "unknown" : operation,url.toUtf8().constData());
+        }
+    }
+    QAtomicInt _stopping;
+private:
+    SeimiLoopMonitor *_monitor;
+};
+
+SeimiLoopMonitor::SeimiLoopMonitor(QObject *parent) : QObject(parent),
+    _lastBeatAt(0),
+    _stallThresholdMs(0),
+    _operation(NULL),
+    _watchdog(NULL)
+{
+    _heartbeat.setTimerType(Qt::PreciseTimer);
+    _heartbeat.setInterval(BeatMs);
+    connect(&_heartbeat,SIGNAL(timeout()),this,SLOT(beat()));
+}
+
+SeimiLoopMonitor* SeimiLoopMonitor::instance(){
+    if(NULL == seimiLoopMonitorInstance){
+        seimiLoopMonitorInstance = new SeimiLoopMonitor();
+    }
+    return seimiLoopMonitorInstance;
+}
+
+void SeimiLoopMonitor::start(int stallThresholdMs){
+    if(stallThresholdMs <= 0 || _watchdog != NULL){
+        return;
+    }
+    _stallThresholdMs = stallThresholdMs;
+    _clock.start();
+    _lastBeatAt.storeRelease(0);
+    _heartbeat.start();
+    _watchdog = new SeimiLoopWatchdog(this);
+    _watchdog->start(QThread::LowPriority);
+}
+
+void SeimiLoopMonitor::stop(){
+    if(_watchdog == NULL){
+        return;
+    }
+    _heartbeat.stop();
+    static_cast<SeimiLoopWatchdog*>(_watchdog)->_stopping.storeRelease(1);
+    _watchdog->wait();
+    delete _watchdog;
+    _watchdog = NULL;
+}
+
+void SeimiLoopMonitor::beat(){
+    qint64 now = _clock.elapsed();
+    qint64 lag = qMax<qint64>(0, now - _lastBeatAt.loadAcquire() - BeatMs);
+    _lastBeatAt.storeRelease(now);
+    SeimiMetrics::instance()->observeLoopLag(lag);
+    if(lag >= _stallThresholdMs){
+        qWarning("[seimi] event loop stalled for %lldms",lag);
+    }
+}
+
+qint64 SeimiLoopMonitor::sinceLastBeat(){
+    return _clock.elapsed() - _lastBeatAt.loadAcquire();
+}
+
+int SeimiLoopMonitor::stallThreshold(){
+    return _stallThresholdMs;
+}
+
+void SeimiLoopMonitor::setActivity(const char *operation, const QString &url){
+    QMutexLocker locker(&_activityMutex);
+    _operation = operation;
+    _url = url;
+}
+
+void SeimiLoopMonitor::activity(const char **operation, QString *url){
+    QMutexLocker locker(&_activityMutex);
+    *operation = _operation;
+    *url = _url;
+}
+
+bool SeimiLoopMonitor::isRunning(){
+    return _watchdog != NULL;
+}
+
+SeimiLoopActivity::SeimiLoopActivity(const char *operation, const QString &url):
+    _active(SeimiLoopMonitor::instance()->isRunning()),
+    _previousOperation(NULL)
+{
+    if(_active){
+        SeimiLoopMonitor::instance()->activity(&_previousOperation,&_previousUrl);
+        SeimiLoopMonitor::instance()->setActivity(operation,url);
+    }
+}
+
+SeimiLoopActivity::~SeimiLoopActivity(){
+    if(_active){
+        SeimiLoopMonitor::instance()->setActivity(_previousOperation,_previousUrl);
+    }
+}
@@ -0,0 +1,76 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef SEIMILOOPMONITOR_H
+#define SEIMILOOPMONITOR_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QAtomicInteger>
+
+/**
+ * Heartbeat on the GUI event loop. Every beat records how late it was dispatched into the
+ * lag histogram, a watchdog thread reports the operation that is holding the loop as soon
+ * as a stall goes past the threshold, while it is still running.
+ */
+class SeimiLoopMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    enum { BeatMs = 100 };
+    static SeimiLoopMonitor* instance();
+
+    void start(int stallThresholdMs);
+    void stop();
+    bool isRunning();
+    /**
+     * set by SeimiLoopActivity around blocking work on the GUI thread
+     */
+    void setActivity(const char *operation, const QString &url);
+    void activity(const char **operation, QString *url);
+    qint64 sinceLastBeat();
+    int stallThreshold();
+
+private slots:
+    void beat();
+
+private:
+    explicit SeimiLoopMonitor(QObject *parent = 0);
+    QTimer _heartbeat;
+    QElapsedTimer _clock;
+    QAtomicInteger<qint64> _lastBeatAt;
+    int _stallThresholdMs;
+    QMutex _activityMutex;
+    const char *_operation;
+    QString _url;
+    QThread *_watchdog;
+};
+
+class SeimiLoopActivity
+{
+public:
+    SeimiLoopActivity(const char *operation, const QString &url);
+    ~SeimiLoopActivity();
+private:
+    bool _active;
+    const char *_previousOperation;
+    QString _previousUrl;
+};
+
+#endif // SEIMILOOPMONITOR_H
@@ -0,0 +1,154 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include "SeimiMetrics.h"
+#include "pillowcore/HttpConnection.h"
+
+static SeimiMetrics* seimiMetricsInstance = NULL;
+
+static const qint64 bucketBoundsMs[SeimiMetrics::BucketCount] = {5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000, 120000};
+
+static const char* const counterNames[SeimiMetrics::CounterCount][2] = {
+    {"seimi_network_requests_total", "Resource requests finished by the network access managers."},
+    {"seimi_network_requests_from_cache_total", "Resource requests served from the disk cache."},
+    {"seimi_network_requests_pipelined_total", "Resource requests sent over a pipelined http connection."},
+    {"seimi_network_requests_secure_total", "Resource requests sent over SSL/TLS."},
+    {"seimi_network_requests_download_buffer_total", "Resource requests delivered through a zerocopy download buffer."},
+    {"seimi_network_bytes_in_total", "Bytes of resources downloaded by renders."},
+    {"seimi_request_bytes_in_total", "Bytes of request content received from clients."},
+    {"seimi_response_bytes_out_total", "Bytes of response content written to clients."},
+    {"seimi_renders_started_total", "Renders started."},
+    {"seimi_renders_finished_total", "Renders finished, whatever their outcome."}
+};
+
+static const char* const gaugeNames[SeimiMetrics::GaugeCount][2] = {
+    {"seimi_active_renders", "Renders currently holding a render slot."},
+    {"seimi_queued_requests", "Requests waiting for a render slot."},
+    {"seimi_live_pages", "SeimiPage objects alive, including ones waiting to be deleted."}
+};
+
+static const char* const errorCauseNames[SeimiMetrics::ErrorCauseCount] = {
+    "rejected", "deadline", "client_gone", "server_error", "load_failed", "resource_timeout", "proxy", "network"
+};
+
+static const char* const phaseNames[SeimiMetrics::PhaseCount] = {"queue", "load", "render", "encode", "total"};
+
+static const char* const outputNames[SeimiMetrics::OutputCount] = {"html", "img", "pdf", "har", "multi"};
+
+SeimiMetrics::SeimiMetrics()
+{
+}
+
+SeimiMetrics* SeimiMetrics::instance(){
+    if(NULL == seimiMetricsInstance){
+        seimiMetricsInstance = new SeimiMetrics();
+    }
+    return seimiMetricsInstance;
+}
+
+SeimiMetrics::Output SeimiMetrics::outputFor(const QString &contentType){
+    if(contentType.contains(',')){
+        return OutputMulti;
+    }else if(contentType == "img"){
+        return OutputImg;
+    }else if(contentType == "pdf"){
+        return OutputPdf;
+    }else if(contentType == "har"){
+        return OutputHar;
+    }
+    return OutputHtml;
+}
+
+void SeimiMetrics::observe(Phase phase, Output output, qint64 ms){
+    observe(_histograms[phase][output],ms);
+}
+
+void SeimiMetrics::observeLoopLag(qint64 ms){
+    observe(_loopLag,ms);
+}
+
+void SeimiMetrics::observe(Histogram &histogram, qint64 ms){
+    if(ms < 0){
+        return;
+    }
+    int bucket = 0;
+    while(bucket < BucketCount && ms > bucketBoundsMs[bucket]){
+        ++bucket;
+    }
+    histogram.buckets[bucket].fetchAndAddRelaxed(1);
+    histogram.sumMs.fetchAndAddRelaxed(ms);
+    histogram.count.fetchAndAddRelaxed(1);
+}
+
+QByteArray SeimiMetrics::exposition() const{
+    QByteArray out;
+    out.reserve(32 * 1024);
+    for (int i = 0; i < CounterCount; ++i) {
+        out.append("# HELP ").append(counterNames[i][0]).append(' ').append(counterNames[i][1]).append('\n');
+        out.append("# TYPE ").append(counterNames[i][0]).append(" counter\n");
+        out.append(counterNames[i][0]).append(' ').append(QByteArray::number(_counters[i].load())).append('\n');
+    }
+    for (int i = 0; i < GaugeCount; ++i) {
+        out.append("# HELP ").append(gaugeNames[i][0]).append(' ').append(gaugeNames[i][1]).append('\n');
+        out.append("# TYPE ").append(gaugeNames[i][0]).append(" gauge\n");
+        out.append(gaugeNames[i][0]).append(' ').append(QByteArray::number(_gauges[i].load())).append('\n');
+    }
+    out.append("# HELP seimi_errors_total Failed or rejected requests by cause.\n");
+    out.append("# TYPE seimi_errors_total counter\n");
+    for (int i = 0; i < ErrorCauseCount; ++i) {
+        out.append("seimi_errors_total{cause=\"").append(errorCauseNames[i]).append("\"} ").append(QByteArray::number(_errors[i].load())).append('\n');
+    }
+    out.append("# HELP seimi_render_phase_seconds Time spent in each phase of a render.\n");
+    out.append("# TYPE seimi_render_phase_seconds histogram\n");
+    for (int p = 0; p < PhaseCount; ++p) {
+        for (int o = 0; o < OutputCount; ++o) {
+            QByteArray labels = QByteArray("phase=\"") + phaseNames[p] + "\",content_type=\"" + outputNames[o] + "\"";
+            appendHistogram(out,"seimi_render_phase_seconds",labels,_histograms[p][o]);
+        }
+    }
+    out.append("# HELP seimi_event_loop_lag_seconds How late the event loop heartbeat was dispatched.\n");
+    out.append("# TYPE seimi_event_loop_lag_seconds histogram\n");
+    appendHistogram(out,"seimi_event_loop_lag_seconds",QByteArray(),_loopLag);
+    return out;
+}
+
+void SeimiMetrics::appendHistogram(QByteArray &out, const char *name, const QByteArray &labels, const Histogram &histogram){
+    QByteArray prefix = labels.isEmpty() ? QByteArray() : labels + ",";
+    QByteArray suffix = labels.isEmpty() ? QByteArray(" ") : "{" + labels + "} ";
+    qint64 cumulative = 0;
+    for (int b = 0; b <= BucketCount; ++b) {
+        cumulative += histogram.buckets[b].load();
+        QByteArray le = b < BucketCount ? QByteArray::number(bucketBoundsMs[b] / 1000.0) : QByteArray("+Inf");
+        out.append(name).append("_bucket{").append(prefix).append("le=\"").append(le).append("\"} ").append(QByteArray::number(cumulative)).append('\n');
+    }
+    out.append(name).append("_sum").append(suffix).append(QByteArray::number(histogram.sumMs.load() / 1000.0)).append('\n');
+    out.append(name).append("_count").append(suffix).append(QByteArray::number(histogram.count.load())).append('\n');
+}
+
+SeimiMetricsHandler::SeimiMetricsHandler(QObject *parent):Pillow::HttpHandler(parent)
+{
+
+}
+
+bool SeimiMetricsHandler::handleRequest(Pillow::HttpConnection *connection){
+    if(connection->requestPath() != "/metrics"){
+        return false;
+    }
+    Pillow::HttpHeaderCollection headers;
+    headers << Pillow::HttpHeader("Content-Type", "text/plain; version=0.0.4");
+    headers << Pillow::HttpHeader("Cache-Control", "no-cache");
+    connection->writeResponse(200, headers, SeimiMetrics::instance()->exposition());
+    return true;
+}
@@ -0,0 +1,100 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef SEIMIMETRICS_H
+#define SEIMIMETRICS_H
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QString>
+#include "pillowcore/HttpHandler.h"
+
+/**
+ * Process wide counters, gauges and latency histograms. Every update is a single relaxed
+ * atomic operation so it can be called from any thread on hot paths.
+ */
+class SeimiMetrics
+{
+public:
+    enum Counter {
+        NetworkRequests,
+        NetworkRequestsFromCache,
+        NetworkRequestsPipelined,
+        NetworkRequestsSecure,
+        NetworkRequestsDownloadBuffer,
+        NetworkBytesIn,
+        RequestBytesIn,
+        ResponseBytesOut,
+        RendersStarted,
+        RendersFinished,
+        CounterCount
+    };
+    enum Gauge { ActiveRenders, QueuedRequests, LivePages, GaugeCount };
+    enum ErrorCause {
+        ErrorRejected,
+        ErrorDeadline,
+        ErrorClientGone,
+        ErrorServer,
+        ErrorLoadFailed,
+        ErrorResourceTimeout,
+        ErrorProxy,
+        ErrorNetwork,
+        ErrorCauseCount
+    };
+    enum Phase { PhaseQueue, PhaseLoad, PhaseRender, PhaseEncode, PhaseTotal, PhaseCount };
+    enum Output { OutputHtml, OutputImg, OutputPdf, OutputHar, OutputMulti, OutputCount };
+    enum { BucketCount = 14 };
+
+    static SeimiMetrics* instance();
+    static Output outputFor(const QString &contentType);
+
+    inline void add(Counter counter, qint64 value = 1) { _counters[counter].fetchAndAddRelaxed(value); }
+    inline void setGauge(Gauge gauge, qint64 value) { _gauges[gauge].fetchAndStoreRelaxed(value); }
+    inline void addGauge(Gauge gauge, qint64 delta) { _gauges[gauge].fetchAndAddRelaxed(delta); }
+    inline void error(ErrorCause cause) { _errors[cause].fetchAndAddRelaxed(1); }
+    void observe(Phase phase, Output output, qint64 ms);
+    void observeLoopLag(qint64 ms);
+
+    /**
+     * Prometheus text exposition format 0.0.4
+     */
+    QByteArray exposition() const;
+
+private:
+    SeimiMetrics();
+    struct Histogram
+    {
+        QAtomicInteger<qint64> buckets[BucketCount + 1];
+        QAtomicInteger<qint64> sumMs;
+        QAtomicInteger<qint64> count;
+    };
+    static void observe(Histogram &histogram, qint64 ms);
+    static void appendHistogram(QByteArray &out, const char *name, const QByteArray &labels, const Histogram &histogram);
+    QAtomicInteger<qint64> _counters[CounterCount];
+    QAtomicInteger<qint64> _gauges[GaugeCount];
+    QAtomicInteger<qint64> _errors[ErrorCauseCount];
+    Histogram _histograms[PhaseCount][OutputCount];
+    Histogram _loopLag;
+};
+
+class SeimiMetricsHandler : public Pillow::HttpHandler
+{
+    Q_OBJECT
+public:
+    SeimiMetricsHandler(QObject* parent = 0);
+    bool handleRequest(Pillow::HttpConnection *connection);
+};
+
+#endif // SEIMIMETRICS_H
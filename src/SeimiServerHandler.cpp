@@ -14,13 +14,28 @@
    limitations under the License.
  */
 #include <QObject>
-#include <QEventLoop>
+#include <QCryptographicHash>
 #include <QNetworkProxy>
+#include <QUrl>
 #include <QRegularExpression>
 #include <QRegularExpressionMatch>
 #include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QUuid>
+#include <QThread>
+#include <QRunnable>
+#include <cmath>
 #include "SeimiServerHandler.h"
 #include "SeimiWebPage.h"
+#include "SeimiMetrics.h"
+#include "SeimiFlightRecorder.h"
+#include "SeimiTracer.h"
+#include "SeimiLoopMonitor.h"
 #include "pillowcore/HttpServer.h"
 #include "pillowcore/HttpHandler.h"
 #include "pillowcore/HttpConnection.h"
@@ -35,9 +50,126 @@ SeimiServerHandler::SeimiServerHandler(QObject *parent):Pillow::HttpHandler(pare
     contentTypeP("contentType"),
     outImgSizeP("outImgSize"),
     uaP("ua"),
-    resourceTimeoutP("resourceTimeout")
+    resourceTimeoutP("resourceTimeout"),
+    deadlineP("deadline"),
+    imgFormatP("imgFormat"),
+    qualityP("quality"),
+    compressionLevelP("compressionLevel"),
+    scaleP("scale"),
+    thumbWidthP("thumbWidth"),
+    clipRectP("clipRect"),
+    clipSelectorP("clipSelector"),
+    envelopeP("envelope"),
+    pdfPaperP("pdfPaper"),
+    pdfOrientationP("pdfOrientation"),
+    pdfImageDpiP("pdfImageDpi"),
+    viewportWidthsP("viewportWidths"),
+    _proxyPool(NULL),
+    _maxRenders(0),
+    _maxQueue(0),
+    _activeRenders(0),
+    _lastDrainAt(-1),
+    _drainIntervalMs(0),
+    _avgRenderMs(0),
+    _timingLog(false),
+    _imgStreamBytes(-1),
+    _encodeThreads(0),
+    _encodeSeq(0),
+    _harSeq(0)
 {
+    _clock.start();
+}
+
+SeimiServerHandler::~SeimiServerHandler(){
+    // no encode task may post its result to a handler that is going away
+    _encodePool.waitForDone();
+}
+
+namespace {
+/**
+ * encodes a painted screenshot and posts it back to SeimiServerHandler::imgEncoded
+ */
+class ImgEncodeTask : public QRunnable
+{
+public:
+    ImgEncodeTask(QObject *handler, quint64 ticket, const QImage &img, bool jpeg, int quality, int compressionLevel) :
+        _handler(handler), _ticket(ticket), _img(img), _jpeg(jpeg), _quality(quality), _compressionLevel(compressionLevel) {}
+    void run(){
+        QByteArray content = SeimiPage::encodeImg(_img, _jpeg, _quality, _compressionLevel);
+        _img = QImage();
+        QCryptographicHash md5sum(QCryptographicHash::Md5);
+        md5sum.addData(content);
+        QMetaObject::invokeMethod(_handler, "imgEncoded", Qt::QueuedConnection,
+                                  Q_ARG(quint64, _ticket), Q_ARG(QByteArray, content), Q_ARG(QByteArray, md5sum.result().toHex()));
+    }
+private:
+    QObject *_handler;
+    quint64 _ticket;
+    QImage _img;
+    bool _jpeg;
+    int _quality;
+    int _compressionLevel;
+};
+}
+
+static Pillow::HttpHeaderCollection noCacheHeaders(){
+    Pillow::HttpHeaderCollection headers;
+    headers << Pillow::HttpHeader("Pragma", "no-cache");
+    headers << Pillow::HttpHeader("Expires", "-1");
+    headers << Pillow::HttpHeader("Cache-Control", "no-cache");
+    return headers;
+}
+
+/**
+ * the distinct output names listed in contentType. Unknown names are left out, as a lone unknown
+ * contentType has always been served as html
+ */
+static QStringList parseOutputs(const QString &contentType){
+    static const QStringList knownOutputs = QStringList() << "html" << "img" << "pdf" << "har";
+    QStringList outputs;
+    foreach (const QString &output, contentType.split(',',QString::SkipEmptyParts)) {
+        QString name = output.trimmed().toLower();
+        if(name.isEmpty() || outputs.contains(name)){
+            continue;
+        }
+        if(!knownOutputs.contains(name)){
+            qWarning("[seimi] unknown contentType[%s] ignored",name.toUtf8().constData());
+            continue;
+        }
+        outputs.append(name);
+    }
+    return outputs;
+}
+
+void SeimiServerHandler::setProxyPool(ProxyPool *proxyPool){
+    _proxyPool = proxyPool;
+}
+
+void SeimiServerHandler::setAdmission(int maxRenders, int maxQueue){
+    _maxRenders = maxRenders;
+    _maxQueue = qMax(0,maxQueue);
+}
+
+void SeimiServerHandler::setTimingLog(bool timingLog){
+    _timingLog = timingLog;
+}
+
+void SeimiServerHandler::setImgStreamThreshold(qint64 bytes){
+    _imgStreamBytes = bytes;
+}
 
+void SeimiServerHandler::setEncodeThreads(int threads){
+    _encodeThreads = threads < 0 ? QThread::idealThreadCount() : threads;
+    if(_encodeThreads > 0){
+        _encodePool.setMaxThreadCount(_encodeThreads);
+    }
+}
+
+void SeimiServerHandler::setHarDir(const QString &harDir){
+    _harDir = harDir;
+    if(!_harDir.isEmpty() && !QDir().mkpath(_harDir)){
+        qWarning("[seimi] can not create har dir[%s]",_harDir.toUtf8().constData());
+    }
 }
 
 bool SeimiServerHandler::handleRequest(Pillow::HttpConnection *connection){
@@ -50,96 +182,784 @@ bool SeimiServerHandler::handleRequest(Pillow::HttpConnection *connection){
     if(path != "/doload"){
         return false;
     }
+    SeimiMetrics::instance()->add(SeimiMetrics::RequestBytesIn,connection->requestContent().size());
+    if(_maxRenders > 0 && _activeRenders >= _maxRenders){
+        if(_queue.size() >= _maxQueue){
+            rejectOverload(connection);
+            return true;
+        }
+        SeimiQueuedRequest queued;
+        queued.connection = connection;
+        queued.queuedAt = _clock.elapsed();
+        _queue.append(queued);
+        SeimiMetrics::instance()->setGauge(SeimiMetrics::QueuedRequests,_queue.size());
+        connect(connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(queuedClientGone(Pillow::HttpConnection*)));
+        return true;
+    }
+    startRender(connection,_clock.elapsed());
+    return true;
+}
+
+void SeimiServerHandler::queuedClientGone(Pillow::HttpConnection *connection){
+    disconnect(connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(queuedClientGone(Pillow::HttpConnection*)));
+    for (int i = 0; i < _queue.size(); ++i) {
+        if(_queue.at(i).connection == connection){
+            _queue.removeAt(i);
+            SeimiMetrics::instance()->setGauge(SeimiMetrics::QueuedRequests,_queue.size());
+            SeimiMetrics::instance()->error(SeimiMetrics::ErrorClientGone);
+            return;
+        }
+    }
+}
+
+static QPageSize::PageSizeId pdfPaperSize(const QString &name){
+    static const struct { const char *name; QPageSize::PageSizeId id; } papers[] = {
+        {"a3", QPageSize::A3}, {"a4", QPageSize::A4}, {"a5", QPageSize::A5}, {"b4", QPageSize::B4}, {"b5", QPageSize::B5},
+        {"letter", QPageSize::Letter}, {"legal", QPageSize::Legal}, {"tabloid", QPageSize::Tabloid}
+    };
+    QString key = name.trimmed().toLower();
+    for (size_t i = 0; i < sizeof(papers) / sizeof(papers[0]); ++i) {
+        if(key == QLatin1String(papers[i].name)){
+            return papers[i].id;
+        }
+    }
+    return QPageSize::A4;
+}
+
+void SeimiServerHandler::startRender(Pillow::HttpConnection *connection, qint64 queuedAt){
+    SeimiRenderContext context;
+    context.connection = connection;
 //    QString url = QUrl::fromPercentEncoding(connection->requestParamValue(urlP).toUtf8());
-    QString url = connection->requestParamValue(urlP);
+    context.url = connection->requestParamValue(urlP);
+    context.outputs = parseOutputs(connection->requestParamValue(contentTypeP));
+    // "img, " and " IMG" are plain img, an empty list is html
+    context.contentType = context.outputs.join(',');
+    context.envelope = connection->requestParamValue(envelopeP);
+    context.pdfPaper = pdfPaperSize(connection->requestParamValue(pdfPaperP));
+    context.pdfOrientation = connection->requestParamValue(pdfOrientationP).toLower() == "landscape" ? QPageLayout::Landscape : QPageLayout::Portrait;
+    context.pdfImageDpi = connection->requestParamValue(pdfImageDpiP).toInt();
+    foreach (const QString &width, connection->requestParamValue(viewportWidthsP).split(',',QString::SkipEmptyParts)) {
+        int w = width.trimmed().toInt();
+        if(w > 0 && !context.viewportWidths.contains(w) && context.viewportWidths.size() < MaxViewports){
+            context.viewportWidths.append(w);
+        }
+    }
+    if(!context.outputs.contains("img")){
+        context.viewportWidths.clear();
+    }
+    context.outImgSize = connection->requestParamValue(outImgSizeP);
+    context.imgFormat = connection->requestParamValue(imgFormatP).toLower();
+    if(context.imgFormat == "jpg"){
+        context.imgFormat = "jpeg";
+    }
+    bool qualityOk = false;
+    context.quality = connection->requestParamValue(qualityP).toInt(&qualityOk);
+    context.quality = qualityOk ? qBound(0,context.quality,100) : 75;
+    bool levelOk = false;
+    context.compressionLevel = connection->requestParamValue(compressionLevelP).toInt(&levelOk);
+    context.compressionLevel = levelOk ? qBound(-1,context.compressionLevel,9) : -1;
+    context.scale = connection->requestParamValue(scaleP).toDouble();
+    if(context.scale <= 0 || context.scale > MaxImgScale){
+        context.scale = 1;
+    }
+    context.thumbWidth = connection->requestParamValue(thumbWidthP).toInt();
+    // x,y,width,height in page pixels
+    QStringList clipRect = connection->requestParamValue(clipRectP).split(',');
+    if(clipRect.size() == 4){
+        context.clipRect = QRect(clipRect.at(0).trimmed().toInt(),clipRect.at(1).trimmed().toInt(),clipRect.at(2).trimmed().toInt(),clipRect.at(3).trimmed().toInt());
+    }
+    context.clipSelector = connection->requestParamValue(clipSelectorP).trimmed();
+    context.deadline = connection->requestParamValue(deadlineP).toInt();
+    context.poolProxyId = -1;
+    context.proxyReported = false;
+    context.queuedAt = queuedAt;
+    context.startedAt = _clock.elapsed();
+    context.acquireCost = -1;
+    context.params = connection->requestParams();
+    QString url = context.url;
     int renderTime = connection->requestParamValue(renderTimeP).toInt();
     QString proxyStr = connection->requestParamValue(proxyP);
-    QString contentType = connection->requestParamValue(contentTypeP);
-    QString outImgSizeStr = connection->requestParamValue(outImgSizeP);
     QString ua = connection->requestParamValue(uaP);
 //    QString jscript = QUrl::fromPercentEncoding(connection->requestParamValue(scriptP).toUtf8());
     QString jscript = connection->requestParamValue(scriptP);
     QString postParamJson = connection->requestParamValue(postParamP);
     int resourceTimeout = connection->requestParamValue(resourceTimeoutP).toInt();
-    Pillow::HttpHeaderCollection headers;
-    headers << Pillow::HttpHeader("Pragma", "no-cache");
-    headers << Pillow::HttpHeader("Expires", "-1");
-    headers << Pillow::HttpHeader("Cache-Control", "no-cache");
+    int useCookieFlag = connection->requestParamValue(useCookieP).toInt();
+    if(context.deadline > 0){
+        // time spent waiting in the admission queue is part of the budget
+        context.deadline = qMax(1,context.deadline - int(context.startedAt - queuedAt));
+    }
+    _activeRenders++;
+    SeimiMetrics *metrics = SeimiMetrics::instance();
+    metrics->setGauge(SeimiMetrics::ActiveRenders,_activeRenders);
+    metrics->add(SeimiMetrics::RendersStarted);
+    metrics->observe(SeimiMetrics::PhaseQueue,SeimiMetrics::outputFor(context.contentType),context.startedAt - queuedAt);
+    SeimiPage *seimiPage = NULL;
     try{
-        QEventLoop eventLoop;
-        SeimiPage *seimiPage=new SeimiPage(this);
+        seimiPage=new SeimiPage(this);
         if(!proxyStr.isEmpty()){
-            QRegularExpression reProxy("(?<protocol>http|https|socket)://(?:(?<user>\\w*):(?<password>\\w*)@)?(?<host>[\\w.]+)(:(?<port>\\d+))?");
-            QRegularExpressionMatch matchProxy = reProxy.match(proxyStr);
-            if(matchProxy.hasMatch()){
-                QNetworkProxy proxy;
-                if(matchProxy.captured("protocol") == "socket"){
-                    proxy.setType(QNetworkProxy::Socks5Proxy);
-                }else{
-                    proxy.setType(QNetworkProxy::HttpProxy);
-                }
-                proxy.setHostName(matchProxy.captured("host"));
-                proxy.setPort(matchProxy.captured("port").toInt()==0?80:matchProxy.captured("port").toInt());
-                proxy.setUser(matchProxy.captured("user"));
-                proxy.setPassword(matchProxy.captured("password"));
-
+            QNetworkProxy proxy;
+            if(ProxyPool::parseProxy(proxyStr,proxy)){
                 seimiPage->setProxy(proxy);
             }else {
                 qWarning("[seimi] proxy pattern error, proxy = %s",proxyStr.toUtf8().constData());
             }
+        }else if(_proxyPool != NULL && !_proxyPool->isEmpty()){
+            context.poolProxyId = _proxyPool->select(QUrl(url).host());
+            if(context.poolProxyId >= 0){
+                QNetworkProxy proxy = _proxyPool->proxyAt(context.poolProxyId);
+                seimiPage->setProxy(proxy);
+                seimiPage->setProxyConnectTimeout(_proxyPool->connectTimeout());
+                QObject::connect(seimiPage,SIGNAL(proxyFailed()),this,SLOT(proxyFailed()));
+                qDebug("[seimi] TargetUrl:%s ,pool proxy:%s",url.toUtf8().constData(),_proxyPool->nameAt(context.poolProxyId).toUtf8().constData());
+            }
         }
         seimiPage->setScript(jscript);
+        seimiPage->setImgClip(context.clipRect,context.clipSelector);
         seimiPage->setPostParam(postParamJson);
         qInfo("[seimi] TargetUrl:%s ,RenderTime(ms):%d",url.toUtf8().constData(),renderTime);
-        int useCookieFlag = connection->requestParamValue(useCookieP).toInt();
         seimiPage->setUseCookie(useCookieFlag==1);
-        QObject::connect(seimiPage,SIGNAL(loadOver()),&eventLoop,SLOT(quit()));
+        seimiPage->setDeadline(context.deadline);
+        // the slow trace ring only needs the compact fields, headers are kept for har output alone
+        bool harWanted = context.outputs.contains("har") || !_harDir.isEmpty();
+        seimiPage->setRecordResources(harWanted || SeimiFlightRecorder::instance()->isEnabled(),harWanted);
+        _renders.insert(seimiPage,context);
+        // queued, so that the page is never finished from inside its own signal emission
+        QObject::connect(seimiPage,SIGNAL(loadOver()),this,SLOT(renderOver()),Qt::QueuedConnection);
+        QObject::connect(connection,SIGNAL(closed(Pillow::HttpConnection*)),seimiPage,SLOT(clientGone()));
+        _renders[seimiPage].acquireCost = _clock.elapsed() - context.startedAt;
         seimiPage->toLoad(url,renderTime,ua,resourceTimeout);
-        eventLoop.exec();
+    }catch (std::exception& e) {
+        qInfo("[seimi error] Page error, url: %s, errorMsg: %s", url.toUtf8().constData(), QString(QLatin1String(e.what())).toUtf8().constData());
+        if(seimiPage != NULL){
+            QObject::disconnect(connection,0,seimiPage,0);
+            _renders.remove(seimiPage);
+            seimiPage->deleteLater();
+        }
+        writeServerError(connection);
+        releaseRenderSlot(context);
+    }catch (...) {
+        qInfo() << "server error!";
+        if(seimiPage != NULL){
+            QObject::disconnect(connection,0,seimiPage,0);
+            _renders.remove(seimiPage);
+            seimiPage->deleteLater();
+        }
+        writeServerError(connection);
+        releaseRenderSlot(context);
+    }
+}
+
+void SeimiServerHandler::renderOver(){
+    SeimiPage *seimiPage = qobject_cast<SeimiPage*>(sender());
+    if(seimiPage == NULL || !_renders.contains(seimiPage)){
+        return;
+    }
+    SeimiRenderContext context = _renders.take(seimiPage);
+    QObject::disconnect(context.connection,0,seimiPage,0);
+    try{
+        finishRender(seimiPage,context);
+    }catch (std::exception& e) {
+        qInfo("[seimi error] Page error, url: %s, errorMsg: %s", context.url.toUtf8().constData(), QString(QLatin1String(e.what())).toUtf8().constData());
+        writeServerError(context.connection);
+    }catch (...) {
+        qInfo() << "server error!";
+        writeServerError(context.connection);
+    }
+    QHash<SeimiPage*, SeimiPendingStream>::iterator stream = _streams.find(seimiPage);
+    if(stream != _streams.end()){
+        // the image is still being streamed, streamOver lets the page and the slot go
+        stream->handedOver = true;
+        return;
+    }
+    seimiPage->deleteLater();
+    releaseRenderSlot(context);
+}
+
+void SeimiServerHandler::proxyFailed(){
+    QHash<SeimiPage*, SeimiRenderContext>::iterator render = _renders.find(qobject_cast<SeimiPage*>(sender()));
+    if(render == _renders.end() || render->poolProxyId < 0 || render->proxyReported){
+        return;
+    }
+    // a dead proxy is ejected without waiting for the render to give up on it
+    render->proxyReported = true;
+    _proxyPool->reportResult(render->poolProxyId,false,0);
+}
 
-        if(contentType == "pdf"){
+static QSize imgTargetSize(const SeimiRenderContext &context){
+    QSize targetSize;
+    if(!context.outImgSize.isEmpty()){
+        static const QRegularExpression reImgSize("(?<xSize>\\d+)(?:x|X)(?<ySize>\\d+)");
+        QRegularExpressionMatch matchImgSize = reImgSize.match(context.outImgSize);
+        if(matchImgSize.hasMatch()){
+            targetSize.setWidth(matchImgSize.captured("xSize").toInt());
+            targetSize.setHeight(matchImgSize.captured("ySize").toInt());
+        }
+    }
+    return targetSize;
+}
+
+static qreal imgScale(const SeimiRenderContext &context, const QRect &area){
+    if(context.thumbWidth > 0){
+        // laid out at the full width, painted straight at the thumbnail width
+        return qMin<qreal>(SeimiServerHandler::MaxImgScale, qreal(context.thumbWidth) / area.width());
+    }
+    return context.scale;
+}
+
+static QByteArray nothingToCapture(const SeimiRenderContext &context){
+    QString errMsg = QString("<html>nothing to capture, clipSelector[%1] matched no element or clipRect is outside the page.</html>").arg(context.clipSelector.toHtmlEscaped());
+    return errMsg.toUtf8();
+}
+
+void SeimiServerHandler::finishRender(SeimiPage *seimiPage, const SeimiRenderContext &context){
+    SeimiTraceScope traceScope("server","finishRender");
+    SeimiLoopActivity loopActivity("finishRender",context.url);
+    Pillow::HttpConnection *connection = context.connection;
+    SeimiMetrics *metrics = SeimiMetrics::instance();
+    SeimiMetrics::Output output = SeimiMetrics::outputFor(context.contentType);
+    if(seimiPage->cancelReason() == SeimiPage::ClientGone){
+        // the connection object may already serve another client, do not touch it
+        qInfo("[seimi] Client of TargetUrl:%s is gone, result dropped.",context.url.toUtf8().constData());
+        metrics->error(SeimiMetrics::ErrorClientGone);
+        traceIfSlow(seimiPage,context,serverTiming(seimiPage,context,-1),0);
+        return;
+    }
+    // proxy errors were reported by proxyFailed as they happened. A dead target, a slow page hitting its deadline
+    // or a script stopping the load says nothing about the proxy, only a clean load counts for it
+    if(context.poolProxyId >= 0 && !context.proxyReported && seimiPage->proxyErrorCount() == 0
+            && seimiPage->cancelReason() == SeimiPage::NotCancelled && seimiPage->isLoadOk()){
+        _proxyPool->reportResult(context.poolProxyId,true,seimiPage->loadElapsed());
+    }
+    Pillow::HttpHeaderCollection headers = noCacheHeaders();
+    int statusCode = 200;
+    QByteArray content;
+    qint64 encodeStartedAt = _clock.elapsed();
+    if(seimiPage->cancelReason() == SeimiPage::DeadlineExceeded){
+        headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
+        QString errMsg = QString("<html>render deadline(%1ms) exceeded.</html>").arg(context.deadline);
+        metrics->error(SeimiMetrics::ErrorDeadline);
+        statusCode = 504;
+        content = errMsg.toUtf8();
+    }else{
+        if(!seimiPage->isLoadOk()){
+            metrics->error(SeimiMetrics::ErrorLoadFailed);
+        }
+        metrics->observe(SeimiMetrics::PhaseLoad,output,seimiPage->loadElapsed());
+        metrics->observe(SeimiMetrics::PhaseRender,output,seimiPage->renderElapsed() - seimiPage->loadElapsed());
+        if(context.outputs.size() > 1 || !context.viewportWidths.isEmpty()){
+            // every output comes from the same load, each one is made inline
+            QList<SeimiOutputPart> parts;
+            foreach (const QString &name, context.outputs) {
+                SeimiOutputPart part;
+                part.name = name;
+                if(name == "img"){
+                    if(!generateImgParts(seimiPage,context,parts,statusCode,content)){
+                        break;
+                    }
+                    continue;
+                }else if(name == "pdf"){
+                    part.contentType = "application/pdf";
+                    part.body = seimiPage->generatePdf(context.pdfPaper,context.pdfOrientation,context.pdfImageDpi);
+                }else if(name == "har"){
+                    part.contentType = "application/json;charset=utf-8";
+                    part.body = seimiPage->generateHar();
+                }else{
+                    part.contentType = "text/html;charset=utf-8";
+                    part.body = seimiPage->getContent().isEmpty()?QByteArray("<html>null</html>"):seimiPage->getContent().toUtf8();
+                }
+                parts.append(part);
+            }
+            if(statusCode == 500){
+                imgFailed(seimiPage,context);
+                return;
+            }
+            if(statusCode != 200){
+                headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
+            }else{
+                content = context.envelope == "json" ? jsonEnvelope(parts,headers) : multipart(parts,headers);
+                QCryptographicHash md5sum(QCryptographicHash::Md5);
+                md5sum.addData(content);
+                headers << Pillow::HttpHeader("ETag", md5sum.result().toHex());
+            }
+        }else if(context.contentType == "pdf"){
             headers << Pillow::HttpHeader("Content-Type", "application/pdf");
-            QByteArray pdfContent = seimiPage->generatePdf();
+            content = seimiPage->generatePdf(context.pdfPaper,context.pdfOrientation,context.pdfImageDpi);
             QCryptographicHash md5sum(QCryptographicHash::Md5);
-            md5sum.addData(pdfContent);
-            QByteArray etag = md5sum.result().toHex();
-            headers << Pillow::HttpHeader("ETag", etag);
-            connection->writeResponse(200,headers,pdfContent);
-        }else if(contentType == "img"){
-            headers << Pillow::HttpHeader("Content-Type", "image/png");
-            QSize targetSize;
-            if(!outImgSizeStr.isEmpty()){
-                QRegularExpression reImgSize("(?<xSize>\\d+)(?:x|X)(?<ySize>\\d+)");
-                QRegularExpressionMatch matchImgSize = reImgSize.match(outImgSizeStr);
-                if(matchImgSize.hasMatch()){
-                    targetSize.setWidth(matchImgSize.captured("xSize").toInt());
-                    targetSize.setHeight(matchImgSize.captured("ySize").toInt());
+            md5sum.addData(content);
+            headers << Pillow::HttpHeader("ETag", md5sum.result().toHex());
+        }else if(context.contentType == "img"){
+            bool jpeg = context.imgFormat == "jpeg";
+            QSize targetSize = imgTargetSize(context);
+            QSize fullSize = targetSize.isNull()||targetSize.width()<=0||targetSize.height()<=0 ? seimiPage->mainFrame()->contentsSize() : targetSize;
+            // taken on the current layout, the screenshot looks it up again once laid out at fullSize
+            QRect area = seimiPage->imgArea(fullSize);
+            if(area.isEmpty()){
+                headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
+                statusCode = 400;
+                content = nothingToCapture(context);
+            }else{
+                headers << Pillow::HttpHeader("Content-Type", jpeg ? "image/jpeg" : "image/png");
+                qreal scale = imgScale(context,area);
+                QSize outSize = SeimiPage::scaledSize(area.size(),scale);
+                // only PNG is written band by band
+                if(!jpeg && _imgStreamBytes >= 0 && qint64(outSize.width()) * outSize.height() * 4 > _imgStreamBytes){
+                    streamImg(seimiPage,context,targetSize,scale,headers,encodeStartedAt);
+                    return;
                 }
+                if(_encodeThreads > 0){
+                    // only the painting needs the page, it is released while the pixels are encoded
+                    QImage img = seimiPage->renderImgFor(targetSize,jpeg,scale);
+                    if(img.isNull()){
+                        imgFailed(seimiPage,context);
+                        return;
+                    }
+                    encodeImgLater(seimiPage,context,img,jpeg,headers,encodeStartedAt);
+                    return;
+                }
+                content = jpeg ? seimiPage->generateJpeg(targetSize,context.quality,scale) : seimiPage->generateImg(targetSize,context.compressionLevel,scale);
+                if(content.isEmpty()){
+                    imgFailed(seimiPage,context);
+                    return;
+                }
+                QCryptographicHash md5sum(QCryptographicHash::Md5);
+                md5sum.addData(content);
+                headers << Pillow::HttpHeader("ETag", md5sum.result().toHex());
             }
-            QByteArray imgContent = seimiPage->generateImg(targetSize);
-            QCryptographicHash md5sum(QCryptographicHash::Md5);
-            md5sum.addData(imgContent);
-            QByteArray etag = md5sum.result().toHex();
-            headers << Pillow::HttpHeader("ETag", etag);
-            connection->writeResponse(200,headers,imgContent);
+        }else if(context.contentType == "har"){
+            headers << Pillow::HttpHeader("Content-Type", "application/json;charset=utf-8");
+            content = seimiPage->generateHar();
         }else{
             headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
-            QString defBody = "<html>null</html>";
-            connection->writeResponse(200, headers,seimiPage->getContent().isEmpty()?defBody.toUtf8():seimiPage->getContent().toUtf8());
+            content = seimiPage->getContent().isEmpty()?QByteArray("<html>null</html>"):seimiPage->getContent().toUtf8();
+        }
+    }
+    qint64 encodeCost = _clock.elapsed() - encodeStartedAt;
+    if(statusCode == 200){
+        metrics->observe(SeimiMetrics::PhaseEncode,output,encodeCost);
+    }
+    QByteArray timing = serverTiming(seimiPage,context,statusCode == 200 ? encodeCost : -1);
+    headers << Pillow::HttpHeader("Server-Timing", timing);
+    qint64 writeStartedAt = _clock.elapsed();
+    respond(connection,statusCode,headers,content);
+    if(_timingLog){
+        // the write can only be measured after the headers went out, so it is only logged
+        qInfo("[seimi] TargetUrl:%s ,Timing:%s, write;dur=%lld",context.url.toUtf8().constData(),timing.constData(),_clock.elapsed() - writeStartedAt);
+    }
+    if(!_harDir.isEmpty()){
+        storeHar(seimiPage,context);
+    }
+    traceIfSlow(seimiPage,context,timing,statusCode);
+}
+
+void SeimiServerHandler::streamImg(SeimiPage *seimiPage, const SeimiRenderContext &context, QSize targetSize, qreal scale, Pillow::HttpHeaderCollection headers, qint64 encodeStartedAt){
+    Pillow::HttpConnection *connection = context.connection;
+    // the headers leave before the image exists, so there is no ETag and encode is only in the timing log
+    headers << Pillow::HttpHeader("Transfer-Encoding", "chunked");
+    headers << Pillow::HttpHeader("Server-Timing", serverTiming(seimiPage,context,-1));
+    connection->writeHeaders(200,headers);
+    SeimiPendingStream &stream = _streams[seimiPage];
+    stream.context = context;
+    stream.encodeStartedAt = encodeStartedAt;
+    stream.bytesOut = 0;
+    stream.painting = true;
+    stream.gone = false;
+    stream.failed = false;
+    stream.handedOver = false;
+    stream.closed = connect(connection,&Pillow::HttpConnection::closed,this,[this,seimiPage](Pillow::HttpConnection*){
+        QHash<SeimiPage*, SeimiPendingStream>::iterator stream = _streams.find(seimiPage);
+        if(stream == _streams.end()){
+            return;
+        }
+        stream->gone = true;
+        if(!stream->painting){
+            streamOver(seimiPage);
+        }
+    });
+    if(connection->outputDevice() != NULL){
+        stream.written = connect(connection->outputDevice(),&QIODevice::bytesWritten,this,[this,seimiPage](qint64){
+            streamBands(seimiPage);
+        });
+    }
+    bool ok = seimiPage->beginImgStream(targetSize,[this,seimiPage](const QByteArray &chunk){
+        QHash<SeimiPage*, SeimiPendingStream>::iterator stream = _streams.find(seimiPage);
+        if(stream == _streams.end() || stream->gone){
+            return false;
         }
+        stream->context.connection->writeContent(chunk);
+        stream->context.connection->flush();
+        stream->bytesOut += chunk.size();
+        return true;
+    },context.compressionLevel,scale);
+    SeimiPendingStream &started = _streams[seimiPage];
+    started.failed = !ok;
+    started.painting = false;
+    streamBands(seimiPage);
+}
+
+void SeimiServerHandler::streamBands(SeimiPage *seimiPage){
+    QHash<SeimiPage*, SeimiPendingStream>::iterator stream = _streams.find(seimiPage);
+    if(stream == _streams.end() || stream->painting){
+        return;
+    }
+    QIODevice *out = stream->context.connection->outputDevice();
+    stream->painting = true;
+    while(!stream->gone && !stream->failed && !seimiPage->isImgStreamDone()){
+        if(out != NULL && out->bytesToWrite() > StreamLowWater){
+            // bytesWritten brings us back once the client has taken some of it, other renders go on meanwhile
+            stream->painting = false;
+            return;
+        }
+        stream->failed = !seimiPage->streamNextBand();
+    }
+    streamOver(seimiPage);
+}
+
+void SeimiServerHandler::streamOver(SeimiPage *seimiPage){
+    SeimiPendingStream &stream = _streams[seimiPage];
+    stream.painting = true;
+    // the end of the PNG still goes through the sink, which stops as soon as the client is gone
+    bool ok = seimiPage->endImgStream(!stream.gone && !stream.failed) && !stream.gone;
+    SeimiPendingStream ended = _streams.take(seimiPage);
+    disconnect(ended.closed);
+    disconnect(ended.written);
+    const SeimiRenderContext &context = ended.context;
+    Pillow::HttpConnection *connection = context.connection;
+    SeimiMetrics *metrics = SeimiMetrics::instance();
+    metrics->add(SeimiMetrics::ResponseBytesOut,ended.bytesOut);
+    if(ended.gone){
+        // the connection object may already serve another client, do not touch it
+        qInfo("[seimi] Client of TargetUrl:%s is gone while streaming the image.",context.url.toUtf8().constData());
+        metrics->error(SeimiMetrics::ErrorClientGone);
+        traceIfSlow(seimiPage,context,serverTiming(seimiPage,context,-1),0);
+    }else if(!ok){
+        // too late for an error status, a cut response is the only way to tell the client
+        qWarning("[seimi] TargetUrl:%s image streaming failed.",context.url.toUtf8().constData());
+        metrics->error(SeimiMetrics::ErrorServer);
+        connection->close();
+    }else{
+        connection->endContent();
+        qint64 encodeCost = _clock.elapsed() - ended.encodeStartedAt;
+        metrics->observe(SeimiMetrics::PhaseEncode,SeimiMetrics::OutputImg,encodeCost);
+        QByteArray timing = serverTiming(seimiPage,context,encodeCost);
+        if(_timingLog){
+            // the write overlaps the encode when streaming
+            qInfo("[seimi] TargetUrl:%s ,Timing:%s, streamed",context.url.toUtf8().constData(),timing.constData());
+        }
+        if(!_harDir.isEmpty()){
+            storeHar(seimiPage,context);
+        }
+        traceIfSlow(seimiPage,context,timing,200);
+    }
+    if(ended.handedOver){
         seimiPage->deleteLater();
-    }catch (std::exception& e) {
-        headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
-        QString errMsg = "<html>server error,please try again.</html>";
-        qInfo("[seimi error] Page error, url: %s, errorMsg: %s", url.toUtf8().constData(), QString(QLatin1String(e.what())).toUtf8().constData());
-        connection->writeResponse(500, headers, errMsg.toUtf8());
-    }catch (...) {
-        qInfo() << "server error!";
-        headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
-        QString errMsg = "<html>server error,please try again.</html>";
-        connection->writeResponse(500, headers, errMsg.toUtf8());
+        releaseRenderSlot(context);
+    }
+}
 
+bool SeimiServerHandler::generateImgParts(SeimiPage *seimiPage, const SeimiRenderContext &context, QList<SeimiOutputPart> &parts, int &statusCode, QByteArray &content){
+    bool jpeg = context.imgFormat == "jpeg";
+    QSize oriViewportSize = seimiPage->viewportSize();
+    // without viewportWidths a single pass at the size the page was loaded at, or outImgSize
+    int passes = qMax(1,context.viewportWidths.size());
+    for (int i = 0; i < passes; ++i) {
+        SeimiOutputPart part;
+        part.name = "img";
+        QSize targetSize;
+        if(context.viewportWidths.isEmpty()){
+            targetSize = imgTargetSize(context);
+        }else{
+            int width = context.viewportWidths.at(i);
+            part.name = QString("img-%1").arg(width);
+            targetSize = seimiPage->relayout(width);
+        }
+        QSize fullSize = targetSize.isNull()||targetSize.width()<=0||targetSize.height()<=0 ? seimiPage->mainFrame()->contentsSize() : targetSize;
+        QRect area = seimiPage->imgArea(fullSize);
+        if(area.isEmpty()){
+            seimiPage->setViewportSize(oriViewportSize);
+            statusCode = 400;
+            content = nothingToCapture(context);
+            return false;
+        }
+        part.contentType = jpeg ? "image/jpeg" : "image/png";
+        qreal scale = imgScale(context,area);
+        part.body = jpeg ? seimiPage->generateJpeg(targetSize,context.quality,scale) : seimiPage->generateImg(targetSize,context.compressionLevel,scale);
+        if(part.body.isEmpty()){
+            seimiPage->setViewportSize(oriViewportSize);
+            statusCode = 500;
+            return false;
+        }
+        parts.append(part);
     }
+    seimiPage->setViewportSize(oriViewportSize);
     return true;
 }
 
+void SeimiServerHandler::imgFailed(SeimiPage *seimiPage, const SeimiRenderContext &context){
+    // the area is not empty, so the image could not be allocated or encoded, most likely a huge page
+    qWarning("[seimi] TargetUrl:%s the screenshot could not be made.",context.url.toUtf8().constData());
+    writeServerError(context.connection);
+    traceIfSlow(seimiPage,context,serverTiming(seimiPage,context,-1),500);
+}
+
+QByteArray SeimiServerHandler::multipart(const QList<SeimiOutputPart> &parts, Pillow::HttpHeaderCollection &headers){
+    QByteArray boundary = "seimi-" + QUuid::createUuid().toRfc4122().toHex();
+    headers << Pillow::HttpHeader("Content-Type", "multipart/mixed; boundary=" + boundary);
+    int size = 0;
+    foreach (const SeimiOutputPart &part, parts) {
+        size += part.body.size() + 160;
+    }
+    QByteArray out;
+    out.reserve(size);
+    foreach (const SeimiOutputPart &part, parts) {
+        out.append("--").append(boundary).append("\r\n");
+        out.append("Content-Type: ").append(part.contentType).append("\r\n");
+        out.append("Content-Disposition: inline; name=\"").append(part.name.toUtf8()).append("\"\r\n");
+        out.append("Content-Length: ").append(QByteArray::number(part.body.size())).append("\r\n\r\n");
+        out.append(part.body).append("\r\n");
+    }
+    out.append("--").append(boundary).append("--\r\n");
+    return out;
+}
+
+QByteArray SeimiServerHandler::jsonEnvelope(const QList<SeimiOutputPart> &parts, Pillow::HttpHeaderCollection &headers){
+    headers << Pillow::HttpHeader("Content-Type", "application/json;charset=utf-8");
+    QJsonObject envelope;
+    foreach (const SeimiOutputPart &part, parts) {
+        QJsonObject entry;
+        entry.insert("contentType",QString::fromLatin1(part.contentType));
+        if(part.contentType.contains("charset=utf-8")){
+            entry.insert("text",QString::fromUtf8(part.body));
+        }else{
+            entry.insert("base64",QString::fromLatin1(part.body.toBase64()));
+        }
+        envelope.insert(part.name,entry);
+    }
+    return QJsonDocument(envelope).toJson(QJsonDocument::Compact);
+}
+
+void SeimiServerHandler::encodeImgLater(SeimiPage *seimiPage, const SeimiRenderContext &context, const QImage &img, bool jpeg, const Pillow::HttpHeaderCollection &headers, qint64 encodeStartedAt){
+    // everything the response still needs from the page is taken now, it is deleted once this returns
+    SeimiPendingEncode pending;
+    pending.context = context;
+    pending.headers = headers;
+    pending.pageTiming = pageTiming(seimiPage,context);
+    if(SeimiFlightRecorder::instance()->isEnabled()){
+        pending.pageTrace = pageTrace(seimiPage,context);
+    }
+    pending.encodeStartedAt = encodeStartedAt;
+    if(!_harDir.isEmpty()){
+        storeHar(seimiPage,context);
+    }
+    quint64 ticket = ++_encodeSeq;
+    _encodes.insert(ticket,pending);
+    connect(context.connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(encodingClientGone(Pillow::HttpConnection*)));
+    _encodePool.start(new ImgEncodeTask(this,ticket,img,jpeg,context.quality,context.compressionLevel));
+}
+
+void SeimiServerHandler::imgEncoded(quint64 ticket, const QByteArray &content, const QByteArray &etag){
+    if(!_encodes.contains(ticket)){
+        // the client is gone, see encodingClientGone
+        return;
+    }
+    SeimiPendingEncode pending = _encodes.take(ticket);
+    const SeimiRenderContext &context = pending.context;
+    Pillow::HttpConnection *connection = context.connection;
+    disconnect(connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(encodingClientGone(Pillow::HttpConnection*)));
+    if(content.isEmpty()){
+        qWarning("[seimi] TargetUrl:%s the screenshot could not be encoded.",context.url.toUtf8().constData());
+        writeServerError(connection);
+        qint64 totalMs = _clock.elapsed() - context.queuedAt;
+        if(SeimiFlightRecorder::instance()->isSlow(totalMs)){
+            recordTrace(pending.pageTrace,context,closeTiming(pending.pageTiming,context,-1),500,totalMs);
+        }
+        return;
+    }
+    qint64 encodeCost = _clock.elapsed() - pending.encodeStartedAt;
+    SeimiMetrics::instance()->observe(SeimiMetrics::PhaseEncode,SeimiMetrics::OutputImg,encodeCost);
+    // encode covers painting, the wait for a worker and the encoding itself
+    QByteArray timing = closeTiming(pending.pageTiming,context,encodeCost);
+    Pillow::HttpHeaderCollection headers = pending.headers;
+    headers << Pillow::HttpHeader("ETag", etag);
+    headers << Pillow::HttpHeader("Server-Timing", timing);
+    qint64 writeStartedAt = _clock.elapsed();
+    respond(connection,200,headers,content);
+    if(_timingLog){
+        qInfo("[seimi] TargetUrl:%s ,Timing:%s, write;dur=%lld",context.url.toUtf8().constData(),timing.constData(),_clock.elapsed() - writeStartedAt);
+    }
+    qint64 totalMs = _clock.elapsed() - context.queuedAt;
+    if(SeimiFlightRecorder::instance()->isSlow(totalMs)){
+        recordTrace(pending.pageTrace,context,timing,200,totalMs);
+    }
+}
+
+void SeimiServerHandler::encodingClientGone(Pillow::HttpConnection *connection){
+    disconnect(connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(encodingClientGone(Pillow::HttpConnection*)));
+    QMutableHashIterator<quint64, SeimiPendingEncode> it(_encodes);
+    while(it.hasNext()){
+        it.next();
+        if(it.value().context.connection != connection){
+            continue;
+        }
+        // the encode still runs to its end, its result is dropped in imgEncoded
+        const SeimiRenderContext &context = it.value().context;
+        qInfo("[seimi] Client of TargetUrl:%s is gone while encoding the image, result dropped.",context.url.toUtf8().constData());
+        SeimiMetrics::instance()->error(SeimiMetrics::ErrorClientGone);
+        qint64 totalMs = _clock.elapsed() - context.queuedAt;
+        if(SeimiFlightRecorder::instance()->isSlow(totalMs)){
+            recordTrace(it.value().pageTrace,context,closeTiming(it.value().pageTiming,context,-1),0,totalMs);
+        }
+        it.remove();
+    }
+}
+
+void SeimiServerHandler::traceIfSlow(SeimiPage *seimiPage, const SeimiRenderContext &context, const QByteArray &timing, int statusCode){
+    qint64 totalMs = _clock.elapsed() - context.queuedAt;
+    if(!SeimiFlightRecorder::instance()->isSlow(totalMs)){
+        return;
+    }
+    recordTrace(pageTrace(seimiPage,context),context,timing,statusCode,totalMs);
+}
+
+QJsonObject SeimiServerHandler::pageTrace(SeimiPage *seimiPage, const SeimiRenderContext &context){
+    // the traces are served on /debug/slow without any authentication, nothing secret may end up in them
+    static const QRegularExpression reUserInfo("://[^@/]*@");
+    QJsonObject params;
+    foreach (const Pillow::HttpParam &param, context.params) {
+        if(param.first.compare(proxyP,Qt::CaseInsensitive) == 0){
+            params.insert(param.first,QString(param.second).replace(reUserInfo,"://"));
+        }else if(param.first.compare(postParamP,Qt::CaseInsensitive) == 0 || param.first.compare(scriptP,Qt::CaseInsensitive) == 0){
+            params.insert(param.first,QString("<%1 chars>").arg(param.second.size()));
+        }else{
+            params.insert(param.first,param.second);
+        }
+    }
+    static const char* const cancelReasons[] = {"", "deadline", "client_gone"};
+    QJsonObject trace;
+    trace.insert("cancelled",QString::fromLatin1(cancelReasons[seimiPage->cancelReason()]));
+    trace.insert("loadOk",seimiPage->isLoadOk());
+    if(context.poolProxyId >= 0){
+        // host:port only, the credentials of the pool entry stay out
+        trace.insert("proxy",_proxyPool->nameAt(context.poolProxyId));
+    }
+    trace.insert("params",params);
+    trace.insert("resources",seimiPage->resourceTrace());
+    return trace;
+}
+
+void SeimiServerHandler::recordTrace(QJsonObject trace, const SeimiRenderContext &context, const QByteArray &timing, int statusCode, qint64 totalMs){
+    trace.insert("time",QDateTime::currentDateTime().toString(Qt::ISODate));
+    trace.insert("url",context.url);
+    trace.insert("totalMs",totalMs);
+    // 0 when the client was gone and nothing was written
+    trace.insert("status",statusCode);
+    trace.insert("timing",QString::fromLatin1(timing));
+    SeimiFlightRecorder::instance()->record(trace);
+}
+
+void SeimiServerHandler::storeHar(SeimiPage *seimiPage, const SeimiRenderContext &context){
+    QString host = QUrl(context.url).host();
+    QString fileName = QString("%1-%2-%3.har")
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz"))
+            .arg(++_harSeq)
+            .arg(host.isEmpty()?QString("page"):host);
+    QFile harFile(QDir(_harDir).filePath(fileName));
+    if(!harFile.open(QIODevice::WriteOnly)){
+        qWarning("[seimi] can not write har file[%s]",harFile.fileName().toUtf8().constData());
+        return;
+    }
+    harFile.write(seimiPage->generateHar());
+}
+
+static void appendTiming(QByteArray &timing, const char *name, qint64 ms){
+    if(ms < 0){
+        return;
+    }
+    if(!timing.isEmpty()){
+        timing.append(", ");
+    }
+    timing.append(name).append(";dur=").append(QByteArray::number(ms));
+}
+
+QByteArray SeimiServerHandler::serverTiming(SeimiPage *seimiPage, const SeimiRenderContext &context, qint64 encodeCost){
+    return closeTiming(pageTiming(seimiPage,context),context,encodeCost);
+}
+
+QByteArray SeimiServerHandler::pageTiming(SeimiPage *seimiPage, const SeimiRenderContext &context){
+    QByteArray timing;
+    appendTiming(timing,"queue",context.startedAt - context.queuedAt);
+    appendTiming(timing,"acquire",context.acquireCost);
+    // page phases are measured from the start of the load
+    appendTiming(timing,"ttfb",seimiPage->firstByteElapsed());
+    if(seimiPage->isOver()){
+        appendTiming(timing,"load",seimiPage->loadElapsed());
+        qint64 waitCost = seimiPage->renderElapsed() - seimiPage->loadElapsed() - qMax<qint64>(0,seimiPage->scriptCost()) - seimiPage->toHtmlCost();
+        appendTiming(timing,"wait",qMax<qint64>(0,waitCost));
+    }
+    appendTiming(timing,"script",seimiPage->scriptCost());
+    appendTiming(timing,"html",seimiPage->toHtmlCost());
+    return timing;
+}
+
+QByteArray SeimiServerHandler::closeTiming(QByteArray timing, const SeimiRenderContext &context, qint64 encodeCost){
+    appendTiming(timing,"encode",encodeCost);
+    appendTiming(timing,"total",_clock.elapsed() - context.queuedAt);
+    return timing;
+}
+
+void SeimiServerHandler::releaseRenderSlot(const SeimiRenderContext &context){
+    qint64 now = _clock.elapsed();
+    qint64 renderMs = now - context.startedAt;
+    SeimiMetrics *metrics = SeimiMetrics::instance();
+    metrics->add(SeimiMetrics::RendersFinished);
+    metrics->observe(SeimiMetrics::PhaseTotal,SeimiMetrics::outputFor(context.contentType),now - context.queuedAt);
+    _avgRenderMs = _avgRenderMs <= 0 ? renderMs : _avgRenderMs * 0.8 + renderMs * 0.2;
+    // the drain interval only means something while renders are actually waiting for slots
+    bool saturated = _maxRenders > 0 && _activeRenders >= _maxRenders;
+    if(saturated && _lastDrainAt >= 0){
+        qint64 interval = now - _lastDrainAt;
+        _drainIntervalMs = _drainIntervalMs <= 0 ? interval : _drainIntervalMs * 0.8 + interval * 0.2;
+    }
+    _lastDrainAt = saturated ? now : -1;
+    _activeRenders--;
+    metrics->setGauge(SeimiMetrics::ActiveRenders,_activeRenders);
+    while(!_queue.isEmpty() && (_maxRenders <= 0 || _activeRenders < _maxRenders)){
+        SeimiQueuedRequest queued = _queue.takeFirst();
+        metrics->setGauge(SeimiMetrics::QueuedRequests,_queue.size());
+        disconnect(queued.connection,SIGNAL(closed(Pillow::HttpConnection*)),this,SLOT(queuedClientGone(Pillow::HttpConnection*)));
+        startRender(queued.connection,queued.queuedAt);
+    }
+}
+
+int SeimiServerHandler::retryAfterSeconds(){
+    double intervalMs = _drainIntervalMs;
+    if(intervalMs <= 0){
+        intervalMs = _avgRenderMs > 0 ? _avgRenderMs / qMax(1,_maxRenders) : 1000;
+    }
+    int seconds = int(std::ceil((_queue.size() + 1) * intervalMs / 1000.0));
+    return qBound(1,seconds,120);
+}
+
+void SeimiServerHandler::rejectOverload(Pillow::HttpConnection *connection){
+    int retryAfter = retryAfterSeconds();
+    qWarning("[seimi] Overloaded, renders:%d queued:%d, reject with Retry-After:%ds",_activeRenders,_queue.size(),retryAfter);
+    Pillow::HttpHeaderCollection headers = noCacheHeaders();
+    headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
+    headers << Pillow::HttpHeader("Retry-After", QByteArray::number(retryAfter));
+    QString errMsg = "<html>server busy,please try again later.</html>";
+    SeimiMetrics::instance()->error(SeimiMetrics::ErrorRejected);
+    respond(connection, 503, headers, errMsg.toUtf8());
+}
+
+void SeimiServerHandler::writeServerError(Pillow::HttpConnection *connection){
+    Pillow::HttpHeaderCollection headers = noCacheHeaders();
+    headers << Pillow::HttpHeader("Content-Type", "text/html;charset=utf-8");
+    QString errMsg = "<html>server error,please try again.</html>";
+    SeimiMetrics::instance()->error(SeimiMetrics::ErrorServer);
+    respond(connection, 500, headers, errMsg.toUtf8());
+}
+
+void SeimiServerHandler::respond(Pillow::HttpConnection *connection, int statusCode, const Pillow::HttpHeaderCollection &headers, const QByteArray &content){
+    SeimiMetrics::instance()->add(SeimiMetrics::ResponseBytesOut,content.size());
+    connection->writeResponse(statusCode, headers, content);
+}
@@ -15,16 +15,168 @@
  */
 #ifndef SEIMISERVERHANDLER_H
 #define SEIMISERVERHANDLER_H
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QThreadPool>
 #include "pillowcore/HttpHandler.h"
 #include "pillowcore/HttpConnection.h"
 #include "SeimiWebPage.h"
+#include "ProxyPool.h"
+
+struct SeimiRenderContext
+{
+    Pillow::HttpConnection *connection;
+    QString url;
+    QString contentType;
+    /**
+     * the outputs listed in contentType, several of them are returned in one envelope
+     */
+    QStringList outputs;
+    QString envelope;
+    /**
+     * img is captured once per width, from the same load
+     */
+    QList<int> viewportWidths;
+    QString outImgSize;
+    QString imgFormat;
+    int quality;
+    int compressionLevel;
+    qreal scale;
+    int thumbWidth;
+    QRect clipRect;
+    QString clipSelector;
+    QPageSize::PageSizeId pdfPaper;
+    QPageLayout::Orientation pdfOrientation;
+    int pdfImageDpi;
+    int deadline;
+    int poolProxyId;
+    /**
+     * a proxy failure is reported to the pool as soon as it happens, and only once
+     */
+    bool proxyReported;
+    qint64 queuedAt;
+    qint64 startedAt;
+    qint64 acquireCost;
+    Pillow::HttpParamCollection params;
+};
+
+struct SeimiQueuedRequest
+{
+    Pillow::HttpConnection *connection;
+    qint64 queuedAt;
+};
+
+struct SeimiOutputPart
+{
+    QString name;
+    QByteArray contentType;
+    QByteArray body;
+};
+
+/**
+ * a PNG streamed band by band, the next band is painted once the client has taken the previous ones
+ */
+struct SeimiPendingStream
+{
+    SeimiRenderContext context;
+    qint64 encodeStartedAt;
+    qint64 bytesOut;
+    /**
+     * set while a band or the trailer is being written, flushing it may emit bytesWritten and closed right away
+     */
+    bool painting;
+    bool gone;
+    bool failed;
+    /**
+     * renderOver has returned and left the page and the render slot to streamOver
+     */
+    bool handedOver;
+    QMetaObject::Connection written;
+    QMetaObject::Connection closed;
+};
+
+struct SeimiPendingEncode
+{
+    SeimiRenderContext context;
+    Pillow::HttpHeaderCollection headers;
+    QByteArray pageTiming;
+    QJsonObject pageTrace;
+    qint64 encodeStartedAt;
+};
 
 class SeimiServerHandler : public Pillow::HttpHandler
 {
+    Q_OBJECT
 public:
+    enum { StreamLowWater = 256 * 1024, MaxImgScale = 4, MaxViewports = 16 };
     SeimiServerHandler(QObject* parent = 0);
+    ~SeimiServerHandler();
     bool handleRequest(Pillow::HttpConnection *connection);
+    void setProxyPool(ProxyPool *proxyPool);
+    /**
+     * maxRenders <= 0 means no limit. Once maxRenders renders are running, up to maxQueue
+     * requests wait for a free slot and any further one is rejected with 503.
+     */
+    void setAdmission(int maxRenders, int maxQueue);
+    /**
+     * also write the Server-Timing breakdown of every render to the log, plus the response write time
+     */
+    void setTimingLog(bool timingLog);
+    /**
+     * store a HAR file of every render into harDir
+     */
+    void setHarDir(const QString &harDir);
+    /**
+     * screenshots whose raw pixels would take more than bytes are painted, encoded and sent
+     * band by band instead of built in memory, < 0 never streams
+     */
+    void setImgStreamThreshold(qint64 bytes);
+    /**
+     * screenshots are encoded on this many threads while their page is released right away,
+     * < 0 means one per core, 0 encodes on the event loop thread
+     */
+    void setEncodeThreads(int threads);
+
+private slots:
+    void renderOver();
+    void proxyFailed();
+    void queuedClientGone(Pillow::HttpConnection *connection);
+    void imgEncoded(quint64 ticket, const QByteArray &content, const QByteArray &etag);
+    void encodingClientGone(Pillow::HttpConnection *connection);
+
 private:
+    void startRender(Pillow::HttpConnection *connection, qint64 queuedAt);
+    void finishRender(SeimiPage *seimiPage, const SeimiRenderContext &context);
+    void releaseRenderSlot(const SeimiRenderContext &context);
+    void rejectOverload(Pillow::HttpConnection *connection);
+    int retryAfterSeconds();
+    void writeServerError(Pillow::HttpConnection *connection);
+    void respond(Pillow::HttpConnection *connection, int statusCode, const Pillow::HttpHeaderCollection &headers, const QByteArray &content);
+    void streamImg(SeimiPage *seimiPage, const SeimiRenderContext &context, QSize targetSize, qreal scale, Pillow::HttpHeaderCollection headers, qint64 encodeStartedAt);
+    void streamBands(SeimiPage *seimiPage);
+    void streamOver(SeimiPage *seimiPage);
+    /**
+     * false with statusCode and content set to the error when an output can not be produced, statusCode 500 alone when an image came out empty
+     */
+    bool generateImgParts(SeimiPage *seimiPage, const SeimiRenderContext &context, QList<SeimiOutputPart> &parts, int &statusCode, QByteArray &content);
+    /**
+     * 500 for a screenshot of a non empty area that still came out empty
+     */
+    void imgFailed(SeimiPage *seimiPage, const SeimiRenderContext &context);
+    QByteArray multipart(const QList<SeimiOutputPart> &parts, Pillow::HttpHeaderCollection &headers);
+    QByteArray jsonEnvelope(const QList<SeimiOutputPart> &parts, Pillow::HttpHeaderCollection &headers);
+    void encodeImgLater(SeimiPage *seimiPage, const SeimiRenderContext &context, const QImage &img, bool jpeg, const Pillow::HttpHeaderCollection &headers, qint64 encodeStartedAt);
+    void storeHar(SeimiPage *seimiPage, const SeimiRenderContext &context);
+    void traceIfSlow(SeimiPage *seimiPage, const SeimiRenderContext &context, const QByteArray &timing, int statusCode);
+    QJsonObject pageTrace(SeimiPage *seimiPage, const SeimiRenderContext &context);
+    void recordTrace(QJsonObject trace, const SeimiRenderContext &context, const QByteArray &timing, int statusCode, qint64 totalMs);
+    QByteArray serverTiming(SeimiPage *seimiPage, const SeimiRenderContext &context, qint64 encodeCost);
+    QByteArray pageTiming(SeimiPage *seimiPage, const SeimiRenderContext &context);
+    QByteArray closeTiming(QByteArray timing, const SeimiRenderContext &context, qint64 encodeCost);
+
     QString renderTimeP;
     QString urlP;
     QString proxyP;
@@ -35,6 +187,38 @@ private:
     QString outImgSizeP;
     QString uaP;
     QString resourceTimeoutP;
+    QString deadlineP;
+    QString imgFormatP;
+    QString qualityP;
+    QString compressionLevelP;
+    QString scaleP;
+    QString thumbWidthP;
+    QString clipRectP;
+    QString clipSelectorP;
+    QString envelopeP;
+    QString pdfPaperP;
+    QString pdfOrientationP;
+    QString pdfImageDpiP;
+    QString viewportWidthsP;
+    ProxyPool *_proxyPool;
+    QHash<SeimiPage*, SeimiRenderContext> _renders;
+    QHash<SeimiPage*, SeimiPendingStream> _streams;
+    QList<SeimiQueuedRequest> _queue;
+    int _maxRenders;
+    int _maxQueue;
+    int _activeRenders;
+    QElapsedTimer _clock;
+    qint64 _lastDrainAt;
+    double _drainIntervalMs;
+    double _avgRenderMs;
+    bool _timingLog;
+    QString _harDir;
+    qint64 _imgStreamBytes;
+    int _encodeThreads;
+    QThreadPool _encodePool;
+    QHash<quint64, SeimiPendingEncode> _encodes;
+    quint64 _encodeSeq;
+    int _harSeq;
 };
 
 #endif // SEIMISERVERHANDLER_H
@@ -0,0 +1,256 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <QAtomicInteger>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QThreadStorage>
+#include <string.h>
+#include "SeimiTracer.h"
+#include "pillowcore/HttpConnection.h"
+
+bool SeimiTracer::_enabled = false;
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char *category;
+        const char *name;
+        char phase;
+        qint64 ts;
+        qint64 dur;
+        quintptr id;
+        char detail[112];
+    };
+
+    /**
+     * single producer (the owning thread), single consumer (the flusher)
+     */
+    class TraceRing
+    {
+    public:
+        enum { Capacity = 8192 };
+        TraceRing(int tid, const QString &threadName) : tid(tid), threadName(threadName), head(0), tail(0), dropped(0), retired(0) {}
+        inline TraceEvent* reserve() {
+            quint32 h = head.load();
+            if (h - tail.loadAcquire() >= Capacity) {
+                dropped.fetchAndAddRelaxed(1);
+                return 0;
+            }
+            return &events[h % Capacity];
+        }
+        inline void commit() { head.storeRelease(head.load() + 1); }
+
+        const int tid;
+        const QString threadName;
+        TraceEvent events[Capacity];
+        QAtomicInteger<quint32> head;
+        QAtomicInteger<quint32> tail;
+        QAtomicInteger<quint32> dropped;
+        /**
+         * set once the owning thread has exited, the flusher frees the ring when it has drained it
+         */
+        QAtomicInt retired;
+    };
+
+    // the rings outlive their threads, the flusher may still be draining them
+    struct TraceRingRef
+    {
+        TraceRing *ring;
+        TraceRingRef() : ring(0) {}
+        ~TraceRingRef() {
+            if (ring)
+                ring->retired.storeRelease(1);
+        }
+    };
+
+    class TraceFlusher : public QThread
+    {
+    public:
+        TraceFlusher() : stopping(0) {}
+        void run();
+        void drain();
+        QFile file;
+        QAtomicInt stopping;
+    };
+
+    QElapsedTimer traceClock;
+    QMutex ringsMutex;
+    QList<TraceRing*> rings;
+    int lastTid = 0;
+    QThreadStorage<TraceRingRef> localRing;
+    TraceFlusher *flusher = 0;
+    qint64 pid = 0;
+}
+
+static TraceRing* currentRing(){
+    TraceRingRef &ref = localRing.localData();
+    if (ref.ring == 0) {
+        QMutexLocker locker(&ringsMutex);
+        QString threadName = QThread::currentThread()->objectName();
+        if (threadName.isEmpty())
+            threadName = QThread::currentThread() == qApp->thread() ? QString("gui") : QString("thread-%1").arg(lastTid);
+        ref.ring = new TraceRing(++lastTid, threadName);
+        rings.append(ref.ring);
+    }
+    return ref.ring;
+}
+
+static void appendEscaped(QByteArray &out, const char *text){
+    for (const char *c = text; *c; ++c) {
+        if (*c == '"' || *c == '\\')
+            out.append('\\').append(*c);
+        else if (uchar(*c) < 0x20)
+            out.append(' ');
+        else
+            out.append(*c);
+    }
+}
+
+static void httpConnectionStateChanged(Pillow::HttpConnection *connection, Pillow::HttpConnection::State state){
+    static const char* const stateNames[] = {"Uninitialized", "ReceivingHeaders", "ReceivingContent", "SendingHeaders", "SendingContent", "Completed", "Flushing", "Closed"};
+    SeimiTracer::instant("http", stateNames[state], connection);
+}
+
+bool SeimiTracer::start(const QString &path){
+    if (flusher)
+        return true;
+    flusher = new TraceFlusher();
+    flusher->file.setFileName(path);
+    if (!flusher->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("[seimi] can not open trace file[%s]", path.toUtf8().constData());
+        delete flusher;
+        flusher = 0;
+        return false;
+    }
+    // JSON array format, trace viewers accept it without the closing bracket if we get killed
+    flusher->file.write("[\n");
+    pid = QCoreApplication::applicationPid();
+    traceClock.start();
+    Pillow::HttpConnection::setStateObserver(httpConnectionStateChanged);
+    _enabled = true;
+    flusher->start(QThread::LowPriority);
+    qInfo("[seimi] trace events are written to %s", path.toUtf8().constData());
+    return true;
+}
+
+void SeimiTracer::stop(){
+    if (!flusher)
+        return;
+    _enabled = false;
+    Pillow::HttpConnection::setStateObserver(0);
+    flusher->stopping.storeRelease(1);
+    flusher->wait();
+    flusher->file.write("{}]\n");
+    flusher->file.close();
+    delete flusher;
+    flusher = 0;
+}
+
+qint64 SeimiTracer::nowUs(){
+    return traceClock.nsecsElapsed() / 1000;
+}
+
+void SeimiTracer::record(char phase, const char *category, const char *name, quintptr id, qint64 startUs, qint64 durationUs, const QByteArray &detail){
+    TraceRing *ring = currentRing();
+    TraceEvent *event = ring->reserve();
+    if (!event)
+        return;
+    event->category = category;
+    event->name = name;
+    event->phase = phase;
+    event->ts = phase == 'X' ? startUs : nowUs();
+    event->dur = durationUs;
+    event->id = id;
+    int detailSize = qMin(detail.size(), int(sizeof(event->detail)) - 1);
+    memcpy(event->detail, detail.constData(), detailSize);
+    event->detail[detailSize] = '\0';
+    ring->commit();
+}
+
+void TraceFlusher::run(){
+    while (!stopping.loadAcquire()) {
+        drain();
+        msleep(200);
+    }
+    drain();
+}
+
+void TraceFlusher::drain(){
+    QList<TraceRing*> current;
+    {
+        QMutexLocker locker(&ringsMutex);
+        current = rings;
+    }
+    QByteArray out;
+    QList<TraceRing*> drained;
+    foreach (TraceRing *ring, current) {
+        // read before head, so that a retired ring is known to have nothing more coming
+        bool retired = ring->retired.loadAcquire();
+        quint32 tail = ring->tail.load();
+        quint32 head = ring->head.loadAcquire();
+        if (tail == 0 && head > 0) {
+            out.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":").append(QByteArray::number(pid))
+               .append(",\"tid\":").append(QByteArray::number(ring->tid))
+               .append(",\"args\":{\"name\":\"").append(ring->threadName.toUtf8()).append("\"}},\n");
+        }
+        for (; tail != head; ++tail) {
+            const TraceEvent &event = ring->events[tail % TraceRing::Capacity];
+            out.append("{\"name\":\"").append(event.name)
+               .append("\",\"cat\":\"").append(event.category)
+               .append("\",\"ph\":\"").append(event.phase)
+               .append("\",\"ts\":").append(QByteArray::number(event.ts))
+               .append(",\"pid\":").append(QByteArray::number(pid))
+               .append(",\"tid\":").append(QByteArray::number(ring->tid));
+            if (event.phase == 'X')
+                out.append(",\"dur\":").append(QByteArray::number(event.dur));
+            if (event.phase == 'i')
+                out.append(",\"s\":\"t\",\"args\":{\"id\":\"0x").append(QByteArray::number(quint64(event.id), 16)).append("\"}");
+            else if (event.phase == 'b' || event.phase == 'e')
+                out.append(",\"id\":\"0x").append(QByteArray::number(quint64(event.id), 16)).append('"');
+            if (event.detail[0]) {
+                out.append(",\"args\":{\"detail\":\"");
+                appendEscaped(out, event.detail);
+                out.append("\"}");
+            }
+            out.append("},\n");
+        }
+        ring->tail.storeRelease(tail);
+        quint32 dropped = ring->dropped.fetchAndStoreRelaxed(0);
+        if (dropped > 0)
+            qWarning("[seimi] trace ring of thread %s overflowed, %u events dropped", ring->threadName.toUtf8().constData(), dropped);
+        if (retired)
+            drained.append(ring);
+    }
+    if (!drained.isEmpty()) {
+        // pool threads expire and come back, each new one gets a new ring
+        QMutexLocker locker(&ringsMutex);
+        foreach (TraceRing *ring, drained) {
+            rings.removeOne(ring);
+        }
+        locker.unlock();
+        qDeleteAll(drained);
+    }
+    if (!out.isEmpty()) {
+        file.write(out);
+        file.flush();
+    }
+}
@@ -0,0 +1,73 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef SEIMITRACER_H
+#define SEIMITRACER_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Opt-in Chrome trace_event recorder, the output file loads in chrome://tracing or Perfetto.
+ * Every thread appends to its own lock-free ring and a background thread drains the rings
+ * to the file, so recording never blocks nor allocates. Names and categories must be string
+ * literals, they are kept by pointer. When the tracer is off every call is a single branch.
+ */
+class SeimiTracer
+{
+public:
+    static bool start(const QString &path);
+    static void stop();
+    static inline bool isEnabled() { return _enabled; }
+    static qint64 nowUs();
+
+    /**
+     * async spans may begin and end in different event loop iterations, id tells them apart
+     */
+    static inline void asyncBegin(const char *category, const char *name, const void *id, const QByteArray &detail = QByteArray()) {
+        if (_enabled) record('b', category, name, quintptr(id), 0, 0, detail);
+    }
+    static inline void asyncEnd(const char *category, const char *name, const void *id) {
+        if (_enabled) record('e', category, name, quintptr(id), 0, 0, QByteArray());
+    }
+    static inline void instant(const char *category, const char *name, const void *id) {
+        if (_enabled) record('i', category, name, quintptr(id), 0, 0, QByteArray());
+    }
+    static inline void complete(const char *category, const char *name, qint64 startUs, qint64 durationUs) {
+        if (_enabled) record('X', category, name, 0, startUs, durationUs, QByteArray());
+    }
+
+private:
+    static void record(char phase, const char *category, const char *name, quintptr id, qint64 startUs, qint64 durationUs, const QByteArray &detail);
+    static bool _enabled;
+};
+
+/**
+ * traces the enclosing scope as a complete event of the current thread
+ */
+class SeimiTraceScope
+{
+public:
+    inline SeimiTraceScope(const char *category, const char *name) : _category(category), _name(name), _startUs(SeimiTracer::isEnabled() ? SeimiTracer::nowUs() : -1) {}
+    inline ~SeimiTraceScope() {
+        if (_startUs >= 0) SeimiTracer::complete(_category, _name, _startUs, SeimiTracer::nowUs() - _startUs);
+    }
+private:
+    const char *_category;
+    const char *_name;
+    qint64 _startUs;
+};
+
+#endif // SEIMITRACER_H
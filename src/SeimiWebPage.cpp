@@ -22,14 +22,22 @@
 #include <QJsonParseError>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QJsonArray>
+#include <QCoreApplication>
 #include <QNetworkRequest>
 #include <QPainter>
-#include <QTemporaryFile>
 #include <QBuffer>
-#include <QEventLoop>
+#include <QtMath>
+#include <QWebElement>
 #include "NetworkAccessManager.h"
 #include "SeimiAgent.h"
-#include <QPrinter>
+#include "SeimiMetrics.h"
+#include "SeimiTracer.h"
+#include "SeimiLoopMonitor.h"
+#include "SeimiLog.h"
+#include "PngParallelEncoder.h"
+#include "PdfImageCap.h"
+#include <QPdfWriter>
 
 SeimiPage::SeimiPage(QObject *parent) : QObject(parent)
 {
@@ -51,28 +59,83 @@ SeimiPage::SeimiPage(QObject *parent) : QObject(parent)
     _isProxyHasBeenSet = false;
     _renderTime = 0;
     _useCookie = false;
+    _networkAccessManager = NULL;
+    _loadOk = false;
+    _loadElapsed = 0;
+    _renderElapsed = 0;
+    _firstByteElapsed = -1;
+    _scriptCost = -1;
+    _toHtmlCost = -1;
+    _deadline = 0;
+    _proxyConnectTimeout = 0;
+    _recordResources = false;
+    _recordFull = false;
+    _cancelReason = NotCancelled;
+    _streamEncoder = NULL;
+    _streamScale = 1;
+    _streamTop = 0;
 
     connect(_sWebPage,SIGNAL(loadFinished(bool)),SLOT(loadAllFinished(bool)));
     connect(_sWebPage,SIGNAL(loadProgress(int)),SLOT(processLog(int)));
+    SeimiMetrics::instance()->addGauge(SeimiMetrics::LivePages,1);
+    SeimiTracer::asyncBegin("page","SeimiPage",this);
 }
 
-void SeimiPage::loadAllFinished(bool){
+SeimiPage::~SeimiPage(){
+    delete _streamEncoder;
+    SeimiMetrics::instance()->addGauge(SeimiMetrics::LivePages,-1);
+    SeimiTracer::asyncEnd("page","SeimiPage",this);
+}
+
+void SeimiPage::loadAllFinished(bool ok){
+    if(_cancelReason != NotCancelled){
+        return;
+    }
+    _loadOk = ok;
+    _loadElapsed = _loadTimer.elapsed();
+    SeimiTracer::asyncEnd("page","load",this);
+    SeimiTracer::asyncBegin("page","wait",this);
     qInfo("[Seimi] All load finished.");
     QTimer::singleShot(_renderTime,this,SLOT(renderFinalHtml()));
 }
 
 void SeimiPage::renderFinalHtml(){
+    if(_cancelReason != NotCancelled||_isContentSet){
+        return;
+    }
+    SeimiTracer::asyncEnd("page","wait",this);
     if(!_script.isEmpty()){
         QVariant evalResult;
-        evalResult = _sWebPage->mainFrame()->evaluateJavaScript(_script);
+        qint64 scriptStartedAt = _loadTimer.elapsed();
+        {
+            SeimiTraceScope traceScope("page","evaluateJavaScript");
+            SeimiLoopActivity loopActivity("evaluateJavaScript",_url);
+            evalResult = _sWebPage->mainFrame()->evaluateJavaScript(_script);
+        }
+        _scriptCost = _loadTimer.elapsed() - scriptStartedAt;
         qDebug() << "[Seimi] - evaluateJavaScript result=" << evalResult;
         qInfo()<< "[Seimi] evaluateJavaScript done. script=" << _script;
-        QEventLoop eventLoop;
-        QTimer::singleShot(_renderTime/2,&eventLoop,SLOT(quit()));
-        eventLoop.exec();
+        // give the script's own timers a chance to run, without a nested loop that could delete this page under us
+        QTimer::singleShot(_renderTime/2,this,SLOT(takeContent()));
+        return;
+    }
+    takeContent();
+}
+
+void SeimiPage::takeContent(){
+    if(_cancelReason != NotCancelled||_isContentSet){
+        return;
+    }
+    qint64 toHtmlStartedAt = _loadTimer.elapsed();
+    {
+        SeimiTraceScope traceScope("page","toHtml");
+        SeimiLoopActivity loopActivity("toHtml",_url);
+        _content = _sWebPage->mainFrame()->toHtml();
     }
-    _content = _sWebPage->mainFrame()->toHtml();
+    _renderElapsed = _loadTimer.elapsed();
+    _toHtmlCost = _renderElapsed - toHtmlStartedAt;
     _isContentSet = true;
+    SeimiTracer::asyncEnd("page","render",this);
     emit loadOver();
     qInfo("[Seimi] Document render out over.");
 }
@@ -99,23 +162,45 @@ bool SeimiPage::isProxySet(){
 }
 
 void SeimiPage::processLog(int p){
-    qInfo("[seimi] TargetUrl[%s] process:%d%",_url.toUtf8().constData(),p);
+    if(!SeimiLog::isEnabled(SeimiLog::Info)){
+        return;
+    }
+    // progress ticks are by far the most frequent lines, only a sample of them is kept
+    if(p == 100 || SeimiLog::sampleProgress()){
+        SeimiLogLine(SeimiLog::Info,"progress").kv("url",_url).kv("progress",p);
+    }
 }
 
 void SeimiPage::toLoad(const QString &url, int renderTime, const QString &ua, int resourceTimeout){
     this->_url = url;
     this->_renderTime = renderTime;
-    NetworkAccessManager *networkAccessManager = new NetworkAccessManager(this);
-    networkAccessManager->setCurrentUrl(url);
-    networkAccessManager->setUserAgent(ua);
-    networkAccessManager->setResourceTimeout(resourceTimeout);
+    _networkAccessManager = new NetworkAccessManager(this);
+    _networkAccessManager->setCurrentUrl(url);
+    _networkAccessManager->setUserAgent(ua);
+    _networkAccessManager->setResourceTimeout(resourceTimeout);
     if(isProxySet()){
-        networkAccessManager->setProxy(_proxy);
+        _networkAccessManager->setProxy(_proxy);
+        _networkAccessManager->setProxyConnectTimeout(_proxyConnectTimeout);
     }
+    connect(_networkAccessManager,SIGNAL(proxyFailed()),SIGNAL(proxyFailed()));
     if(_useCookie){
-        networkAccessManager->setCookieJar(new CookieJar());
+        _networkAccessManager->setCookieJar(new CookieJar());
+    }
+    if(_deadline > 0){
+        _networkAccessManager->setRenderDeadline(_deadline);
+        connect(_networkAccessManager,SIGNAL(renderDeadlineExceeded()),SLOT(deadlineExceeded()));
+    }
+    connect(_networkAccessManager,SIGNAL(mainDocumentResponded()),SLOT(mainDocumentResponded()));
+    if(_recordResources){
+        _networkAccessManager->setRecordResources(true,_recordFull);
+        _loadStartedDateTime = QDateTime::currentDateTimeUtc();
     }
-    _sWebPage->setNetworkAccessManager(networkAccessManager);
+    _sWebPage->setNetworkAccessManager(_networkAccessManager);
+    if(SeimiTracer::isEnabled()){
+        SeimiTracer::asyncBegin("page","render",this,url.toUtf8());
+        SeimiTracer::asyncBegin("page","load",this);
+    }
+    _loadTimer.start();
     if(_postParamStr.isEmpty()){
         _sWebPage->mainFrame()->load(QUrl(url));
     }else{
@@ -137,6 +222,84 @@ void SeimiPage::toLoad(const QString &url, int renderTime, const QString &ua, in
 
 }
 
+bool SeimiPage::isLoadOk(){
+    return _loadOk;
+}
+
+qint64 SeimiPage::loadElapsed(){
+    return _loadElapsed;
+}
+
+qint64 SeimiPage::renderElapsed(){
+    return _renderElapsed;
+}
+
+qint64 SeimiPage::firstByteElapsed(){
+    return _firstByteElapsed;
+}
+
+qint64 SeimiPage::scriptCost(){
+    return _scriptCost;
+}
+
+qint64 SeimiPage::toHtmlCost(){
+    return _toHtmlCost;
+}
+
+void SeimiPage::mainDocumentResponded(){
+    _firstByteElapsed = _loadTimer.elapsed();
+}
+
+int SeimiPage::proxyErrorCount(){
+    return _networkAccessManager == NULL ? 0 : _networkAccessManager->proxyErrorCount();
+}
+
+void SeimiPage::setDeadline(int deadline){
+    _deadline = deadline;
+}
+
+void SeimiPage::setProxyConnectTimeout(int timeoutMs){
+    _proxyConnectTimeout = timeoutMs;
+}
+
+void SeimiPage::setRecordResources(bool recordResources, bool fullRecords){
+    _recordResources = recordResources;
+    _recordFull = fullRecords;
+}
+
+SeimiPage::CancelReason SeimiPage::cancelReason(){
+    return _cancelReason;
+}
+
+void SeimiPage::deadlineExceeded(){
+    cancelLoad(DeadlineExceeded);
+}
+
+void SeimiPage::clientGone(){
+    cancelLoad(ClientGone);
+}
+
+void SeimiPage::cancelLoad(CancelReason reason){
+    if(_cancelReason != NotCancelled){
+        return;
+    }
+    if(_isContentSet){
+        // loadOver is already queued with the content, only a gone client changes what is done with it
+        if(reason == ClientGone){
+            _cancelReason = reason;
+        }
+        return;
+    }
+    _cancelReason = reason;
+    qInfo("[seimi] TargetUrl[%s] render cancelled, reason:%s",_url.toUtf8().constData(),reason == ClientGone?"client gone":"deadline exceeded");
+    _sWebPage->triggerAction(QWebPage::Stop);
+    if(_networkAccessManager != NULL){
+        _networkAccessManager->abortPendingReplies();
+    }
+    SeimiTracer::asyncEnd("page","render",this);
+    emit loadOver();
+}
+
 void SeimiPage::setUseCookie(bool useCoookie){
     _useCookie = useCoookie;
 }
@@ -145,74 +308,321 @@ void SeimiPage::setPostParam(QString &jsonStr){
     _postParamStr = jsonStr;
 }
 
-QByteArray SeimiPage::generateImg(QSize &targetSize){
+QByteArray SeimiPage::generateImg(QSize &targetSize, int compressionLevel, qreal scale){
+    SeimiTraceScope traceScope("encode","generateImg");
+    SeimiLoopActivity loopActivity("generateImg",_url);
+    return encodeImg(renderImgFor(targetSize, false, scale), false, 0, compressionLevel);
+}
+
+QByteArray SeimiPage::generateJpeg(QSize &targetSize, int quality, qreal scale){
+    SeimiTraceScope traceScope("encode","generateJpeg");
+    SeimiLoopActivity loopActivity("generateJpeg",_url);
+    return encodeImg(renderImgFor(targetSize, true, scale), true, quality, -1);
+}
+
+QImage SeimiPage::renderImgFor(QSize &targetSize, bool jpeg, qreal scale){
+    if(!jpeg){
+        return renderImg(targetSize, DefaultTileSize, false, scale);
+    }
+    if(targetSize.isNull()||targetSize.width()<=0||targetSize.height()<=0){
+        targetSize = _sWebPage->mainFrame()->contentsSize();
+    }
+    if(_clipSelector.isEmpty() && !_clipRect.isValid()){
+        int maxSide = int(JpegMaxSide / scale);
+        targetSize = targetSize.boundedTo(QSize(maxSide, maxSide));
+    }
+    return renderImg(targetSize, DefaultTileSize, true, scale);
+}
+
+QByteArray SeimiPage::encodeImg(const QImage &img, bool jpeg, int quality, int compressionLevel){
+    if(!jpeg){
+        SeimiTraceScope pngScope("encode","png");
+        return PngParallelEncoder::encode(img, compressionLevel);
+    }
+    QByteArray out;
+    QBuffer buffer(&out);
+    buffer.open(QIODevice::WriteOnly);
+    SeimiTraceScope jpegScope("encode","jpeg");
+    img.save(&buffer,"jpg",quality);
+    return out;
+}
+
+QImage SeimiPage::renderImg(QSize &targetSize, int tileSize, bool opaque, qreal scale){
     if(targetSize.isNull()||targetSize.width()<=0||targetSize.height()<=0){
         targetSize = _sWebPage->mainFrame()->contentsSize();
     }
-    QRect tRect = QRect(QPoint(0, 0), targetSize);
-    qDebug()<<"finalSize:"<<targetSize;
     QSize oriViewportSize = _sWebPage->viewportSize();
     _sWebPage->setViewportSize(targetSize);
+    // the clip is looked up once the page has its final layout
+    QRect pageArea = imgArea(targetSize);
+    qDebug()<<"finalSize:"<<targetSize<<"area:"<<pageArea<<"scale:"<<scale;
+    if(pageArea.isEmpty()){
+        _sWebPage->setViewportSize(oriViewportSize);
+        return QImage();
+    }
+    QRect tRect = QRect(QPoint(0, 0), scaledSize(pageArea.size(), scale));
+    QImage imgRes(tRect.size(), opaque ? QImage::Format_RGB32 : imgFormat());
+    imgRes.fill(opaque ? Qt::white : Qt::transparent);
+    paintArea(imgRes, tRect, tileSize, scale, pageArea.topLeft());
+    _sWebPage->setViewportSize(oriViewportSize);
+    return imgRes;
+}
+
+bool SeimiPage::streamImg(QSize &targetSize, const PngStreamEncoder::Sink &sink, int compressionLevel, qreal scale){
+    SeimiTraceScope traceScope("encode","streamImg");
+    SeimiLoopActivity loopActivity("streamImg",_url);
+    if(!beginImgStream(targetSize, sink, compressionLevel, scale)){
+        return false;
+    }
+    bool ok = true;
+    while(ok && !isImgStreamDone()){
+        ok = streamNextBand();
+    }
+    return endImgStream(ok);
+}
+
+bool SeimiPage::beginImgStream(QSize &targetSize, const PngStreamEncoder::Sink &sink, int compressionLevel, qreal scale){
+    if(_streamEncoder != NULL){
+        return false;
+    }
+    if(targetSize.isNull()||targetSize.width()<=0||targetSize.height()<=0){
+        targetSize = _sWebPage->mainFrame()->contentsSize();
+    }
+    if(targetSize.isEmpty()){
+        return false;
+    }
+    _streamViewportSize = _sWebPage->viewportSize();
+    _sWebPage->setViewportSize(targetSize);
+    _streamPageArea = imgArea(targetSize);
+    if(_streamPageArea.isEmpty()){
+        _sWebPage->setViewportSize(_streamViewportSize);
+        return false;
+    }
+    // the other bands are painted in later event loop iterations, timers and late resources must not move the page meanwhile
+    _sWebPage->triggerAction(QWebPage::Stop);
+    _sWebPage->settings()->setAttribute(QWebSettings::JavascriptEnabled,false);
+    _streamScale = scale;
+    _streamOutSize = scaledSize(_streamPageArea.size(), scale);
+    _streamTop = 0;
+    _streamEncoder = new PngStreamEncoder(sink, compressionLevel);
+    // the only pixels alive at any time are one band, reused from top to bottom
+    _streamBand = QImage(_streamOutSize.width(), qMin<int>(BandRows, _streamOutSize.height()), imgFormat());
+    if(!_streamEncoder->begin(_streamOutSize.width(), _streamOutSize.height())){
+        endImgStream(false);
+        return false;
+    }
+    return true;
+}
+
+bool SeimiPage::streamNextBand(){
+    SeimiTraceScope traceScope("encode","streamBand");
+    SeimiLoopActivity loopActivity("streamBand",_url);
+    if(isImgStreamDone()){
+        return false;
+    }
+    QRect area(0, _streamTop, _streamOutSize.width(), qMin<int>(BandRows, _streamOutSize.height() - _streamTop));
+    _streamBand.fill(Qt::transparent);
+    paintArea(_streamBand, area, DefaultTileSize, _streamScale, _streamPageArea.topLeft());
+    _streamTop += area.height();
+    return _streamEncoder->writeRows(_streamBand, area.height());
+}
+
+bool SeimiPage::isImgStreamDone(){
+    return _streamEncoder == NULL || _streamTop >= _streamOutSize.height();
+}
+
+bool SeimiPage::endImgStream(bool finish){
+    if(_streamEncoder == NULL){
+        return false;
+    }
+    bool ok = finish && isImgStreamDone() && _streamEncoder->finish();
+    delete _streamEncoder;
+    _streamEncoder = NULL;
+    _streamBand = QImage();
+    _sWebPage->settings()->setAttribute(QWebSettings::JavascriptEnabled,true);
+    _sWebPage->setViewportSize(_streamViewportSize);
+    return ok;
+}
+
+void SeimiPage::setImgClip(const QRect &clipRect, const QString &clipSelector){
+    _clipRect = clipRect;
+    _clipSelector = clipSelector;
+}
+
+QRect SeimiPage::imgArea(const QSize &layoutSize){
+    QRect page(QPoint(0, 0), layoutSize);
+    if(!_clipSelector.isEmpty()){
+        QWebElement element = _sWebPage->mainFrame()->findFirstElement(_clipSelector);
+        return element.isNull() ? QRect() : element.geometry() & page;
+    }
+    if(_clipRect.isValid()){
+        return _clipRect & page;
+    }
+    return page;
+}
+
+QSize SeimiPage::scaledSize(const QSize &layoutSize, qreal scale){
+    return QSize(qMax(1, qCeil(layoutSize.width() * scale)), qMax(1, qCeil(layoutSize.height() * scale)));
+}
+
+QImage::Format SeimiPage::imgFormat(){
 #ifdef Q_OS_WIN
-    QImage::Format format = QImage::Format_ARGB32_Premultiplied;
+    return QImage::Format_ARGB32_Premultiplied;
 #else
-    QImage::Format format = QImage::Format_ARGB32;
+    return QImage::Format_ARGB32;
 #endif
-    QImage imgRes(tRect.size(), format);
-    imgRes.fill(Qt::transparent);
+}
+
+void SeimiPage::paintArea(QImage &target, const QRect &area, int tileSize, qreal scale, const QPoint &origin){
     QPainter painter;
-    int chipSize = 4096;
-    int xChipNum = (imgRes.width()+chipSize -1)/chipSize;
-    int yChipNum = (imgRes.height()+chipSize -1)/chipSize;
+    int chipSize = tileSize > 0 ? tileSize : DefaultTileSize;
+    int xChipNum = (area.width()+chipSize -1)/chipSize;
+    int yChipNum = (area.height()+chipSize -1)/chipSize;
+    uchar *bits = target.bits();
+    int bytesPerLine = target.bytesPerLine();
     for (int x = 0; x < xChipNum; ++x) {
         for (int y = 0; y < yChipNum; ++y) {
-            QImage tmpBuffer(chipSize, chipSize, format);
-            tmpBuffer.fill(Qt::transparent);
-            painter.begin(&tmpBuffer);
+            QRect chip = QRect(area.left() + x * chipSize, area.top() + y * chipSize, chipSize, chipSize) & area;
+            QPoint offset = chip.topLeft() - area.topLeft();
+            // a view on the chip's own rows of target, the page paints straight into the output
+            QImage chipImg(bits + size_t(offset.y()) * bytesPerLine + offset.x() * 4, chip.width(), chip.height(), bytesPerLine, target.format());
+            painter.begin(&chipImg);
             painter.setRenderHint(QPainter::Antialiasing, true);
             painter.setRenderHint(QPainter::TextAntialiasing, true);
             painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
-            painter.translate(-tRect.left(), -tRect.top());
-            painter.translate(-x * chipSize, -y * chipSize);
-            _sWebPage->mainFrame()->render(&painter, QRegion(tRect));
-            painter.end();
-            // do merge
-            painter.begin(&imgRes);
-            painter.setCompositionMode(QPainter::CompositionMode_Source);
-            painter.drawImage(x * chipSize, y * chipSize, tmpBuffer);
+            painter.translate(-chip.left(), -chip.top());
+            // the page keeps its layout and is rasterized straight at the output resolution
+            painter.scale(scale, scale);
+            painter.translate(-origin);
+            // only the part of the page inside this chip is painted
+            QRect pageChip = QRectF(origin.x() + chip.left() / scale, origin.y() + chip.top() / scale, chip.width() / scale, chip.height() / scale).toAlignedRect();
+            _sWebPage->mainFrame()->render(&painter, QRegion(pageChip));
             painter.end();
         }
     }
-    _sWebPage->setViewportSize(oriViewportSize);
+}
+
+QWebFrame* SeimiPage::mainFrame(){
+    return _sWebPage->mainFrame();
+}
+
+QSize SeimiPage::viewportSize(){
+    return _sWebPage->viewportSize();
+}
+
+void SeimiPage::setViewportSize(const QSize &size){
+    _sWebPage->setViewportSize(size);
+}
+
+QSize SeimiPage::relayout(int width){
+    SeimiTraceScope traceScope("encode","relayout");
+    QSize viewport = _sWebPage->viewportSize();
+    _sWebPage->setViewportSize(QSize(width, viewport.height() > 0 ? viewport.height() : width));
+    // asking for the contents size runs the layout at the new width
+    return QSize(width, _sWebPage->mainFrame()->contentsSize().height());
+}
+
+QByteArray SeimiPage::generatePdf(QPageSize::PageSizeId paper, QPageLayout::Orientation orientation, int maxImageDpi){
+    SeimiTraceScope traceScope("encode","generatePdf");
+    SeimiLoopActivity loopActivity("generatePdf",_url);
+    QSize contentsSize = _sWebPage->mainFrame()->contentsSize();
+    int contentWidth = contentsSize.width();
+    int contentHeight = contentsSize.height();
+    if(contentWidth <=0||contentHeight<=0){
+        return QByteArray();
+    }
+    // written straight into memory, no temporary file and no copy of it
     QByteArray out;
     QBuffer buffer(&out);
     buffer.open(QIODevice::WriteOnly);
-    imgRes.save(&buffer,"png",-1);
+    QPdfWriter writer(&buffer);
+    writer.setCreator("SeimiAgent");
+    writer.setPageSize(QPageSize(paper));
+    writer.setPageOrientation(orientation);
+    writer.setPageMargins(QMarginsF(0, 0, 0, 0));
+    // the page keeps its screen layout and is scaled so that its width fills the paper
+    QRect paperRect = writer.pageLayout().fullRectPixels(writer.resolution());
+    qreal scale = qreal(paperRect.width()) / contentWidth;
+    int pageHeight = qMax(1, int(paperRect.height() / scale));
+    qDebug() <<"content W:"<<contentWidth<<"paper W:"<<paperRect.width()<<"scale:"<<scale;
+    QSize oriViewportSize = _sWebPage->viewportSize();
+    _sWebPage->setViewportSize(contentsSize);
+    QPainter pdfPainter(&writer);
+    QScopedPointer<PdfImageCapDevice> capDevice;
+    QPainter capPainter;
+    QPainter *painter = &pdfPainter;
+    if(maxImageDpi > 0){
+        capDevice.reset(new PdfImageCapDevice(&pdfPainter, &writer, writer.resolution(), maxImageDpi));
+        capPainter.begin(capDevice.data());
+        painter = &capPainter;
+    }
+    painter->setRenderHint(QPainter::Antialiasing, true);
+    painter->setRenderHint(QPainter::TextAntialiasing, true);
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, true);
+    for (int top = 0; top < contentHeight; top += pageHeight) {
+        if(top > 0){
+            writer.newPage();
+        }
+        QRect pageRect(0, top, contentWidth, qMin(pageHeight, contentHeight - top));
+        painter->save();
+        painter->scale(scale, scale);
+        painter->translate(0, -top);
+        _sWebPage->mainFrame()->render(painter, QRegion(pageRect));
+        painter->restore();
+    }
+    if(capPainter.isActive()){
+        capPainter.end();
+    }
+    pdfPainter.end();
+    _sWebPage->setViewportSize(oriViewportSize);
     return out;
 }
 
-QByteArray SeimiPage::generatePdf(){
-    int contentWidth = _sWebPage->mainFrame()->contentsSize().width();
-    int contentHeight = _sWebPage->mainFrame()->contentsSize().height();
-    if(contentWidth <=0||contentHeight<=0){
-        return QByteArray();
+QByteArray SeimiPage::generateHar(){
+    QJsonObject pageTimings;
+    pageTimings.insert("onContentLoad", -1);
+    pageTimings.insert("onLoad", _loadOk ? _loadElapsed : -1);
+    QJsonObject page;
+    page.insert("startedDateTime", _loadStartedDateTime.toString("yyyy-MM-dd'T'HH:mm:ss.zzz'Z'"));
+    page.insert("id", "page_1");
+    page.insert("title", _url);
+    page.insert("pageTimings", pageTimings);
+    QJsonObject creator;
+    creator.insert("name", "SeimiAgent");
+    creator.insert("version", QCoreApplication::applicationVersion());
+    QJsonObject log;
+    log.insert("version", "1.2");
+    log.insert("creator", creator);
+    log.insert("pages", QJsonArray() << page);
+    log.insert("entries", _networkAccessManager == NULL ? QJsonArray() : _networkAccessManager->harEntries());
+    QJsonObject har;
+    har.insert("log", log);
+    return QJsonDocument(har).toJson(QJsonDocument::Compact);
+}
+
+QJsonArray SeimiPage::resourceTrace(){
+    QJsonArray resources;
+    if(_networkAccessManager == NULL){
+        return resources;
     }
-    QPrinter printer;
-    printer.setPageSize(QPrinter::A4);
-	printer.setOutputFormat(QPrinter::PdfFormat);
-    printer.setOrientation(QPrinter::Portrait);
-    printer.setFullPage(true);
-    printer.setCollateCopies(true);
-    printer.setPageMargins(0, 0, 0, 0, QPrinter::Point);
-	//try again and again,finally get the relationship between in contentWidth,printerWidth,dpi.
-	int coefDpi = contentWidth * 100 / printer.width();
-    qDebug() <<"content W:"<<contentWidth<< " A4 w:" << printer.width() << "coef:"<<coefDpi;
-    printer.setResolution(coefDpi);
-    QTemporaryFile pdf;
-    pdf.open();
-    printer.setOutputFileName(pdf.fileName());
-    _sWebPage->mainFrame()->print(&printer);
-    QByteArray out = pdf.readAll();
-    pdf.deleteLater();
-    return out;
+    foreach (const ResourceRecord &record, _networkAccessManager->resourceRecords()) {
+        QJsonObject resource;
+        resource.insert("url", record.url.toString());
+        resource.insert("status", record.status);
+        resource.insert("bytes", record.bytesReceived);
+        resource.insert("start", record.startedAt);
+        resource.insert("ttfb", record.firstByteAt - record.startedAt);
+        resource.insert("time", record.finishedAt - record.startedAt);
+        if(record.fromCache){
+            resource.insert("fromCache", true);
+        }
+        if(record.abortCause){
+            resource.insert("aborted", QString::fromLatin1(record.abortCause));
+        }
+        if(!record.error.isEmpty()){
+            resource.insert("error", record.error);
+        }
+        resources.append(resource);
+    }
+    return resources;
 }
@@ -22,24 +22,46 @@
 #include <QThread>
 #include <QNetworkProxy>
 #include <QFile>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QImage>
+#include <QPageSize>
+#include <QPageLayout>
 #include <QtWebKitWidgets/QWebPage>
 #include <QtWebKitWidgets/QWebFrame>
 #include "cookiejar.h"
+#include "PngStreamEncoder.h"
+
+class NetworkAccessManager;
 
 class SeimiPage : public QObject
 {
     Q_OBJECT
 public:
+    enum CancelReason { NotCancelled, DeadlineExceeded, ClientGone };
+    enum { DefaultTileSize = 4096, BandRows = 1024, JpegMaxSide = 65535 };
     explicit SeimiPage(QObject *parent = 0);
+    ~SeimiPage();
 
 signals:
     void loadOver();
+    /**
+     * a request failed because of the proxy, fired at most once as soon as it happens
+     */
+    void proxyFailed();
 
 public slots:
     void loadAllFinished(bool);
     void renderFinalHtml();
     void processLog(int p);
     void toLoad(const QString &url, int renderTime, const QString &ua, int resourceTimeout);
+    void deadlineExceeded();
+    void clientGone();
+    void mainDocumentResponded();
+
+private slots:
+    void takeContent();
 
 public:
     bool isOver();
@@ -50,8 +72,101 @@ public:
     void setScript(QString &script);
     void setUseCookie(bool useCoookie);
     void setPostParam(QString &jsonStr);
-    QByteArray generateImg(QSize &targetSize);
-    QByteArray generatePdf();
+    void setDeadline(int deadline);
+    /**
+     * give up on the main document when nothing came back through the proxy within timeoutMs, <= 0 waits for resourceTimeout
+     */
+    void setProxyConnectTimeout(int timeoutMs);
+    /**
+     * keep every finished resource for resourceTrace, and with their headers for generateHar when fullRecords is set
+     */
+    void setRecordResources(bool recordResources, bool fullRecords = true);
+    /**
+     * screenshots cover only clipRect (page coordinates), or the box of the first element matching
+     * clipSelector when it is set, instead of the whole page
+     */
+    void setImgClip(const QRect &clipRect, const QString &clipSelector);
+    /**
+     * the part of the page laid out at layoutSize that a screenshot covers, empty when clipSelector matches nothing
+     */
+    QRect imgArea(const QSize &layoutSize);
+    CancelReason cancelReason();
+    /**
+     * renderImg encoded as PNG, deflated on the PngParallelEncoder pool
+     */
+    QByteArray generateImg(QSize &targetSize, int compressionLevel = -1, qreal scale = 1);
+    /**
+     * renderImg on white encoded as JPEG, quality 0-100. JPEG stops at JpegMaxSide pixels, taller pages are cut there
+     * unless a clip is set
+     */
+    QByteArray generateJpeg(QSize &targetSize, int quality = 75, qreal scale = 1);
+    /**
+     * paint imgArea of the page laid out at targetSize (contentsSize when empty) into an image of scaledSize(imgArea, scale),
+     * tileSize x tileSize output pixels at a time. opaque paints on white without an alpha channel. Null when imgArea is empty
+     */
+    QImage renderImg(QSize &targetSize, int tileSize = DefaultTileSize, bool opaque = false, qreal scale = 1);
+    /**
+     * the image generateImg (jpeg false) or generateJpeg (jpeg true) would encode
+     */
+    QImage renderImgFor(QSize &targetSize, bool jpeg, qreal scale = 1);
+    /**
+     * PNG or JPEG bytes of img, needs no page so it may run on any thread
+     */
+    static QByteArray encodeImg(const QImage &img, bool jpeg, int quality, int compressionLevel);
+    /**
+     * paint and PNG encode the page BandRows rows at a time, handing the output to sink as it is produced,
+     * so memory stays at one band whatever the page height. false when the sink gave up or encoding failed
+     */
+    bool streamImg(QSize &targetSize, const PngStreamEncoder::Sink &sink, int compressionLevel = -1, qreal scale = 1);
+    /**
+     * streamImg one band per streamNextBand call, so that the bands can follow the client across event loop
+     * iterations. Loading and scripts are stopped so the layout holds in between. false when there is nothing to paint
+     */
+    bool beginImgStream(QSize &targetSize, const PngStreamEncoder::Sink &sink, int compressionLevel = -1, qreal scale = 1);
+    /**
+     * false when the sink gave up or encoding failed
+     */
+    bool streamNextBand();
+    bool isImgStreamDone();
+    /**
+     * write the end of the PNG when finish is set and every band is out, or drop it, and put the viewport back
+     */
+    bool endImgStream(bool finish);
+    /**
+     * size of the image of a page laid out at layoutSize and painted at scale
+     */
+    static QSize scaledSize(const QSize &layoutSize, qreal scale);
+    QWebFrame* mainFrame();
+    QSize viewportSize();
+    void setViewportSize(const QSize &size);
+    /**
+     * lay the loaded page out again at width, nothing is fetched nor run again, and return the size
+     * it then takes. The viewport keeps its new width
+     */
+    QSize relayout(int width);
+    /**
+     * the page as laid out on screen, scaled to the paper width and cut into pages. Images drawn finer than
+     * maxImageDpi are scaled down to it, <= 0 keeps them as they are
+     */
+    QByteArray generatePdf(QPageSize::PageSizeId paper = QPageSize::A4, QPageLayout::Orientation orientation = QPageLayout::Portrait, int maxImageDpi = 0);
+    /**
+     * HTTP Archive 1.2 of every resource finished so far, needs setRecordResources before toLoad
+     */
+    QByteArray generateHar();
+    /**
+     * compact list of the recorded resources, ms are relative to the start of the load
+     */
+    QJsonArray resourceTrace();
+    bool isLoadOk();
+    qint64 loadElapsed();
+    qint64 renderElapsed();
+    /**
+     * -1 when the phase never happened
+     */
+    qint64 firstByteElapsed();
+    qint64 scriptCost();
+    qint64 toHtmlCost();
+    int proxyErrorCount();
 private:
     QWebFrame *_sWebFrame;
     QWebPage *_sWebPage;
@@ -68,6 +183,35 @@ private:
      */
     QString _postParamStr;
     QString _url;
+    NetworkAccessManager *_networkAccessManager;
+    bool _loadOk;
+    QElapsedTimer _loadTimer;
+    qint64 _loadElapsed;
+    qint64 _renderElapsed;
+    qint64 _firstByteElapsed;
+    qint64 _scriptCost;
+    qint64 _toHtmlCost;
+    int _deadline;
+    int _proxyConnectTimeout;
+    bool _recordResources;
+    bool _recordFull;
+    QDateTime _loadStartedDateTime;
+    CancelReason _cancelReason;
+    QRect _clipRect;
+    QString _clipSelector;
+    PngStreamEncoder *_streamEncoder;
+    QImage _streamBand;
+    QRect _streamPageArea;
+    QSize _streamOutSize;
+    QSize _streamViewportSize;
+    qreal _streamScale;
+    int _streamTop;
+    void cancelLoad(CancelReason reason);
+    /**
+     * area is in target pixels, origin is the page point painted at target pixel 0,0
+     */
+    void paintArea(QImage &target, const QRect &area, int tileSize, qreal scale, const QPoint &origin);
+    static QImage::Format imgFormat();
 
 };
 
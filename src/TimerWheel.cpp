@@ -0,0 +1,148 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include "TimerWheel.h"
+
+static TimerWheel* timerWheelInstance = NULL;
+
+TimerWheel::TimerWheel(QObject *parent) : QObject(parent),
+    _freeHead(-1),
+    _current(0),
+    _pending(0),
+    _ticksDone(0)
+{
+    _heads.fill(-1, SlotCount + 1);
+    _ticker.setInterval(TickMs);
+    connect(&_ticker,SIGNAL(timeout()),this,SLOT(tick()));
+}
+
+TimerWheel* TimerWheel::instance(){
+    if(NULL == timerWheelInstance){
+        timerWheelInstance = new TimerWheel();
+    }
+    return timerWheelInstance;
+}
+
+TimerWheel::TimerId TimerWheel::schedule(int timeoutMs, TimerWheelClient *client, quintptr cookie){
+    int index = _freeHead;
+    if(index >= 0){
+        _freeHead = _nodes.at(index).next;
+    }else{
+        Node fresh;
+        fresh.generation = 0;
+        _nodes.append(fresh);
+        index = _nodes.size() - 1;
+    }
+    if(_pending == 0){
+        // the ticker only runs while something is pending, so an idle agent never wakes up
+        _clock.start();
+        _ticksDone = 0;
+        _ticker.start();
+    }
+    int ticks = qMax(1, (timeoutMs + TickMs - 1) / TickMs);
+    Node &node = _nodes[index];
+    node.rounds = (ticks - 1) / SlotCount;
+    node.client = client;
+    node.cookie = cookie;
+    link(index, (_current + ticks) % SlotCount);
+    _pending++;
+    return (TimerId(node.generation) << 32) | TimerId(index + 1);
+}
+
+void TimerWheel::cancel(TimerId id){
+    int index = int(id & 0xffffffff) - 1;
+    if(index < 0 || index >= _nodes.size()){
+        return;
+    }
+    const Node &node = _nodes.at(index);
+    if(node.generation != quint32(id >> 32) || node.list < 0){
+        return; // already fired or cancelled
+    }
+    unlink(index);
+    release(index);
+}
+
+int TimerWheel::pendingCount() const{
+    return _pending;
+}
+
+void TimerWheel::link(int index, int list){
+    Node &node = _nodes[index];
+    node.list = list;
+    node.prev = -1;
+    node.next = _heads.at(list);
+    if(node.next >= 0){
+        _nodes[node.next].prev = index;
+    }
+    _heads[list] = index;
+}
+
+void TimerWheel::unlink(int index){
+    Node &node = _nodes[index];
+    if(node.prev >= 0){
+        _nodes[node.prev].next = node.next;
+    }else{
+        _heads[node.list] = node.next;
+    }
+    if(node.next >= 0){
+        _nodes[node.next].prev = node.prev;
+    }
+}
+
+void TimerWheel::release(int index){
+    Node &node = _nodes[index];
+    node.generation++;
+    node.list = -1;
+    node.client = NULL;
+    node.next = _freeHead;
+    _freeHead = index;
+    _pending--;
+}
+
+void TimerWheel::tick(){
+    // catch up on ticks missed while the event loop was blocked
+    qint64 due = _clock.elapsed() / TickMs;
+    while(_ticksDone < due && _pending > 0){
+        _ticksDone++;
+        advance();
+    }
+    if(_pending == 0){
+        _ticker.stop();
+    }
+}
+
+void TimerWheel::advance(){
+    _current = (_current + 1) % SlotCount;
+    int index = _heads.at(_current);
+    while(index >= 0){
+        int next = _nodes.at(index).next;
+        if(_nodes.at(index).rounds > 0){
+            _nodes[index].rounds--;
+        }else{
+            unlink(index);
+            link(index, SlotCount);
+        }
+        index = next;
+    }
+    // fire one by one, a callback may cancel or schedule other timers
+    while(_heads.at(SlotCount) >= 0){
+        index = _heads.at(SlotCount);
+        TimerWheelClient *client = _nodes.at(index).client;
+        quintptr cookie = _nodes.at(index).cookie;
+        unlink(index);
+        release(index);
+        client->wheelTimeout(cookie);
+    }
+}
@@ -0,0 +1,84 @@
+/*
+   Copyright 2016 Wang Haomiao<et.tw@163.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QObject>
+#include <QVector>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class TimerWheelClient
+{
+public:
+    virtual ~TimerWheelClient() {}
+    virtual void wheelTimeout(quintptr cookie) = 0;
+};
+
+/**
+ * Hashed timer wheel driven by a single coarse QTimer, shared by every render.
+ * Scheduling and cancelling are O(1) and allocate nothing once the node pool is warm.
+ * A client must cancel its pending timers before it is destroyed.
+ * Lives in the GUI thread, not thread safe.
+ */
+class TimerWheel : public QObject
+{
+    Q_OBJECT
+public:
+    typedef quint64 TimerId;
+    enum { TickMs = 100, SlotCount = 256 };
+
+    static TimerWheel* instance();
+
+    TimerId schedule(int timeoutMs, TimerWheelClient *client, quintptr cookie);
+    void cancel(TimerId id);
+    int pendingCount() const;
+
+private slots:
+    void tick();
+
+private:
+    explicit TimerWheel(QObject *parent = 0);
+    struct Node
+    {
+        int prev;
+        int next;
+        int list;
+        int rounds;
+        quint32 generation;
+        TimerWheelClient *client;
+        quintptr cookie;
+    };
+    void link(int index, int list);
+    void unlink(int index);
+    void release(int index);
+    void advance();
+
+    QVector<Node> _nodes;
+    /**
+     * one list head per slot plus a last one holding the timers being fired
+     * @brief _heads
+     */
+    QVector<int> _heads;
+    int _freeHead;
+    int _current;
+    int _pending;
+    QTimer _ticker;
+    QElapsedTimer _clock;
+    qint64 _ticksDone;
+};
+
+#endif // TIMERWHEEL_H
@@ -54,6 +54,8 @@ Q_DECLARE_TYPEINFO(Pillow::HttpHeaderRef, Q_PRIMITIVE_TYPE);
 using namespace Pillow::Tokens;
 using namespace Pillow::ByteArrayHelpers;
 
+static Pillow::HttpConnection::StateObserver stateObserver = 0;
+
 //
 // HttpConnectionPrivate
 //
@@ -189,6 +191,7 @@ inline void Pillow::HttpConnectionPrivate::transitionToReceivingHeaders()
 {
 	if (_state == Pillow::HttpConnection::ReceivingHeaders) return;
 	_state = Pillow::HttpConnection::ReceivingHeaders;
+	if (stateObserver) stateObserver(q_ptr, _state);
 
 	thin_http_parser_init(&_parser);
 	_requestContentLength = 0;
@@ -216,6 +219,7 @@ inline void Pillow::HttpConnectionPrivate::transitionToReceivingContent()
 {
 	if (_state == Pillow::HttpConnection::ReceivingContent) return;
 	_state = Pillow::HttpConnection::ReceivingContent;
+	if (stateObserver) stateObserver(q_ptr, _state);
 
 	setupRequestHeaders();
 
@@ -255,6 +259,7 @@ inline void Pillow::HttpConnectionPrivate::transitionToSendingHeaders()
 {
 	if (_state == Pillow::HttpConnection::SendingHeaders) return;
 	_state = Pillow::HttpConnection::SendingHeaders;
+	if (stateObserver) stateObserver(q_ptr, _state);
 
 	// Prepare and null terminate the request fields.
 
@@ -301,6 +306,7 @@ inline void Pillow::HttpConnectionPrivate::transitionToSendingContent()
 {
 	if (_state == Pillow::HttpConnection::SendingContent) return;
 	_state = Pillow::HttpConnection::SendingContent;
+	if (stateObserver) stateObserver(q_ptr, _state);
 
 	if (_responseHeadersBuffer.capacity() > 4096)
 		_responseHeadersBuffer.clear();
@@ -325,6 +331,7 @@ inline void Pillow::HttpConnectionPrivate::transitionToCompleted()
 		qWarning() << "HttpConnection::transitionToCompleted called while the request is in the closed state.";
 	}
 	_state = Pillow::HttpConnection::Completed;
+	if (stateObserver) stateObserver(q_ptr, _state);
 	emit q_ptr->requestCompleted(q_ptr);
 
 	// Preserve any existing data in the request buffer that did not belong to the completed request.
@@ -377,6 +384,7 @@ inline void Pillow::HttpConnectionPrivate::transitionToFlushing()
 	// wait for all the data to make it to the kernel before closing the connection.
 	if (_state == Pillow::HttpConnection::Flushing) return;
 	_state = Pillow::HttpConnection::Flushing;
+	if (stateObserver) stateObserver(q_ptr, _state);
 
 	drain(); // Will transition to closed also if there was no data at all to flush.
 	if (_state == Pillow::HttpConnection::Flushing) // A first flush was not enough. Schedule more flushes.
@@ -387,6 +395,7 @@ inline void Pillow::HttpConnectionPrivate::transitionToClosed()
 {
 	if (_state == Pillow::HttpConnection::Closed) return;
 	_state = Pillow::HttpConnection::Closed;
+	if (stateObserver) stateObserver(q_ptr, _state);
 
 	if (_inputDevice && _inputDevice->isOpen()) _inputDevice->close();
 	if (_outputDevice && (_inputDevice != _outputDevice) && _outputDevice->isOpen()) _outputDevice->close();
@@ -629,6 +638,11 @@ Pillow::HttpConnection::~HttpConnection()
 	delete d_ptr;
 }
 
+void Pillow::HttpConnection::setStateObserver(StateObserver observer)
+{
+	stateObserver = observer;
+}
+
 void Pillow::HttpConnection::initialize(QIODevice* inputDevice, QIODevice* outputDevice)
 {
 	if (inputDevice != d_ptr->_inputDevice)
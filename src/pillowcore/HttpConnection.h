@@ -47,6 +47,10 @@ namespace Pillow
 		enum { MaximumRequestContentLength = 128 * 1024 * 1024 };
 		Q_ENUMS(State);
 
+		// Called after every state transition of every connection, meant for tracing. Pass 0 to remove it.
+		typedef void (*StateObserver)(Pillow::HttpConnection* connection, State state);
+		static void setStateObserver(StateObserver observer);
+
 	public:
 		HttpConnection(QObject* parent = 0);
 		~HttpConnection();